@@ -0,0 +1,517 @@
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+namespace containers
+{
+
+struct shm_queue_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// QueueMode is the number of producers allowed to push concurrently.
+// In both modes there is exactly one consumer.
+enum class QueueMode { spsc, mpsc };
+
+// ShmQueue is a bounded FIFO queue of fixed size records that lives in a
+// POSIX shared memory object and is shared by cooperating processes.
+//
+// Each process may map the object at a different address, so nothing
+// inside the region is a pointer: the header records the offset of the
+// slot array and the head and tail are monotonically increasing indices
+// which are masked into the slot array. Every slot carries a sequence
+// number which tells producers and the consumer whose turn it is.
+template <typename T, QueueMode Mode = QueueMode::spsc>
+class ShmQueue
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "ShmQueue records are copied between processes as bytes");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                  "ShmQueue requires address-free 64-bit atomics");
+
+public:
+    // ShmQueue opens the shared memory object name, creating and
+    // initializing it with room for capacity records if needed.
+    // The capacity is rounded up to a power of 2.
+    ShmQueue(const std::string& name, std::size_t capacity)
+        : nslots(round_capacity(capacity)),
+          nbytes(region_size(capacity))
+    {
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+        if (fd < 0) {
+            throw_errno("shm_open " + name);
+        }
+
+        // A size of 0 means we are first, or the process which created
+        // the object died before sizing it; ftruncate is idempotent.
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            ::close(fd);
+            throw_errno("fstat " + name);
+        }
+        if (st.st_size == 0 && ::ftruncate(fd, nbytes) < 0) {
+            ::close(fd);
+            throw_errno("ftruncate " + name);
+        }
+        else if (st.st_size != 0 && std::size_t(st.st_size) != nbytes) {
+            ::close(fd);
+            throw shm_queue_error{"shm queue " + name + " has a different size"};
+        }
+
+        void* addr = ::mmap(nullptr, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd); // The mapping keeps the object alive.
+        if (addr == MAP_FAILED) {
+            throw_errno("mmap " + name);
+        }
+        base = static_cast<unsigned char*>(addr);
+
+        try {
+            attach();
+        }
+        catch (...) {
+            ::munmap(base, nbytes);
+            throw;
+        }
+    }
+
+    ShmQueue(const ShmQueue&) = delete;
+    ShmQueue& operator=(const ShmQueue&) = delete;
+
+    ~ShmQueue()
+    {
+        ::munmap(base, nbytes);
+    }
+
+    // try_push copies data into the next free slot.
+    // Returns false when the queue is full.
+    bool try_push(const T& data)
+    {
+        auto& h = header();
+        std::uint64_t pos = h.tail.load(std::memory_order_relaxed);
+        Slot* s = nullptr;
+        for (;;) {
+            s = slot(pos);
+            auto seq = s->seq.load(std::memory_order_acquire);
+            auto diff = std::int64_t(seq - pos);
+            if (diff < 0) {
+                return false; // Consumer has not released the slot yet.
+            }
+            if (Mode == QueueMode::spsc) {
+                h.tail.store(pos + 1, std::memory_order_relaxed);
+                break;
+            }
+            if (diff == 0) {
+                // Claim the slot; on failure pos is reloaded by the CAS.
+                if (h.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else {
+                pos = h.tail.load(std::memory_order_relaxed);
+            }
+        }
+        std::memcpy(&s->data, &data, sizeof(T));
+        s->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // try_pop copies the record at the front of the queue into data and
+    // removes it. Returns false when the queue is empty.
+    bool try_pop(T& data)
+    {
+        return try_consume([&data](const T& v) { std::memcpy(&data, &v, sizeof(T)); });
+    }
+
+    // try_consume calls visit with a reference to the record at the
+    // front of the queue while it is still in shared memory, then
+    // removes it. Returns false when the queue is empty.
+    template <typename Visit>
+    bool try_consume(Visit&& visit)
+    {
+        auto& h = header();
+        std::uint64_t pos = h.head.load(std::memory_order_relaxed);
+        Slot* s = slot(pos);
+        if (s->seq.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        visit(static_cast<const T&>(s->data));
+        // Hand the slot to the producer one lap ahead.
+        s->seq.store(pos + nslots, std::memory_order_release);
+        h.head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // size returns an estimate of the number of records in the queue.
+    std::size_t size() const
+    {
+        const auto& h = header();
+        auto head = h.head.load(std::memory_order_acquire);
+        auto tail = h.tail.load(std::memory_order_acquire);
+        return tail > head ? std::size_t(tail - head) : 0;
+    }
+
+    // capacity returns the maximum number of records in the queue.
+    std::size_t capacity() const
+    {
+        return nslots;
+    }
+
+    // region_size returns the size of the shared memory object used by
+    // a queue of capacity records.
+    static std::size_t region_size(std::size_t capacity)
+    {
+        return slots_offset() + round_capacity(capacity)*sizeof(Slot);
+    }
+
+    // unlink removes the shared memory object name. Processes which
+    // have the queue open may continue to use it.
+    static void unlink(const std::string& name)
+    {
+        ::shm_unlink(name.c_str());
+    }
+
+private:
+    // Slot is a record together with its sequence number.
+    // seq == pos means the slot is free for the producer of pos,
+    // seq == pos+1 means the slot holds the record pushed at pos.
+    struct Slot
+    {
+        std::atomic<std::uint64_t> seq;
+        T data;
+    };
+
+    // Header is stored at offset 0 of the shared memory object.
+    // A zero filled Header is a valid uninitialized Header.
+    struct Header
+    {
+        // init is 0 before initialization, ready once initialized, and
+        // otherwise holds the pid of the initializing process.
+        std::atomic<std::uint64_t> init;
+        std::uint64_t magic;
+        std::uint64_t mode;
+        std::uint64_t record_size;
+        std::uint64_t nslots;
+        std::uint64_t slots_offset;
+        alignas(64) std::atomic<std::uint64_t> head;
+        alignas(64) std::atomic<std::uint64_t> tail;
+    };
+
+    static constexpr std::uint64_t magic_value = 0x5348514555455545; // "SHQEUEUE"
+    static constexpr std::uint64_t init_ready = 1;
+
+    unsigned char* base = nullptr;
+    std::size_t nslots;
+    std::size_t nbytes;
+
+    static std::size_t round_capacity(std::size_t capacity)
+    {
+        std::size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        return n;
+    }
+
+    static constexpr std::size_t slots_offset()
+    {
+        constexpr std::size_t align = alignof(Slot) > 64 ? alignof(Slot) : 64;
+        return (sizeof(Header) + align - 1)/align*align;
+    }
+
+    [[noreturn]] static void throw_errno(const std::string& what)
+    {
+        throw std::system_error{errno, std::generic_category(), what};
+    }
+
+    Header& header()
+    {
+        return *reinterpret_cast<Header*>(base);
+    }
+
+    const Header& header() const
+    {
+        return *reinterpret_cast<const Header*>(base);
+    }
+
+    Slot* slot(std::uint64_t pos)
+    {
+        auto slots = reinterpret_cast<Slot*>(base + header().slots_offset);
+        return slots + (pos & (nslots - 1));
+    }
+
+    // attach initializes the region unless another process has already
+    // done so. If the initializing process died part way through, the
+    // first process to notice takes over and starts again.
+    void attach()
+    {
+        auto& h = header();
+        const std::uint64_t self = std::uint64_t(::getpid()) << 1;
+        for (;;) {
+            auto state = h.init.load(std::memory_order_acquire);
+            if (state == init_ready) {
+                break;
+            }
+            if (state == 0 || !alive(state)) {
+                if (h.init.compare_exchange_strong(state, self, std::memory_order_acq_rel)) {
+                    initialize();
+                    h.init.store(init_ready, std::memory_order_release);
+                    break;
+                }
+                continue;
+            }
+            std::this_thread::yield(); // Initialization in progress.
+        }
+
+        if (h.magic != magic_value
+            || h.mode != std::uint64_t(Mode)
+            || h.record_size != sizeof(T)
+            || h.nslots != nslots
+            || h.slots_offset != slots_offset()) {
+            throw shm_queue_error{"shm queue layout mismatch"};
+        }
+    }
+
+    void initialize()
+    {
+        auto& h = header();
+        h.magic = magic_value;
+        h.mode = std::uint64_t(Mode);
+        h.record_size = sizeof(T);
+        h.nslots = nslots;
+        h.slots_offset = slots_offset();
+        h.head.store(0, std::memory_order_relaxed);
+        h.tail.store(0, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < nslots; ++i) {
+            slot(i)->seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // alive returns whether the process which owns init state exists.
+    static bool alive(std::uint64_t state)
+    {
+        auto pid = pid_t(state >> 1);
+        return ::kill(pid, 0) == 0 || errno != ESRCH;
+    }
+};
+
+}
+
+namespace
+{
+
+// record is the fixed size record exchanged in the tests.
+struct record
+{
+    int producer;
+    int seq;
+};
+
+// shm_name returns a shared memory object name unique to this process.
+std::string shm_name(const char* suffix)
+{
+    return "/containers-shm-queue-" + std::to_string(::getpid()) + "-" + suffix;
+}
+
+// wait_ok waits for child pid and returns whether it exited with 0.
+bool wait_ok(pid_t pid)
+{
+    int status = 0;
+    return ::waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+}
+
+TEST_CASE("[ShmQueue]")
+{
+    using namespace containers;
+
+    auto name = shm_name("basic");
+    ShmQueue<record>::unlink(name);
+    ShmQueue<record> queue(name, 3);
+    REQUIRE(queue.capacity() == 4);
+    REQUIRE(queue.size() == 0);
+
+    record r{};
+    REQUIRE_FALSE(queue.try_pop(r));
+
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE(queue.try_push({0, i}));
+        REQUIRE(queue.size() == std::size_t(i+1));
+    }
+    REQUIRE_FALSE(queue.try_push({0, 4})); // Full.
+
+    // A second mapping of the same object sees the same records.
+    ShmQueue<record> alias(name, 4);
+    REQUIRE(alias.size() == 4);
+    REQUIRE(alias.try_pop(r));
+    REQUIRE(r.seq == 0);
+
+    for (int i = 1; i < 4; ++i) {
+        int seq = -1;
+        REQUIRE(queue.try_consume([&seq](const record& v) { seq = v.seq; }));
+        REQUIRE(seq == i);
+    }
+    REQUIRE(queue.size() == 0);
+    REQUIRE_FALSE(queue.try_pop(r));
+
+    // Indices keep increasing after wrapping around the slots.
+    for (int i = 0; i < 10; ++i) {
+        REQUIRE(queue.try_push({0, i}));
+        REQUIRE(alias.try_pop(r));
+        REQUIRE(r.seq == i);
+    }
+
+    REQUIRE_THROWS_AS((ShmQueue<record>(name, 8)), shm_queue_error);
+    REQUIRE_THROWS_AS((ShmQueue<record, QueueMode::mpsc>(name, 4)), shm_queue_error);
+    ShmQueue<record>::unlink(name);
+}
+
+TEST_CASE("[ShmQueue] spsc between processes")
+{
+    using namespace containers;
+
+    const int n = 100000;
+    auto name = shm_name("spsc");
+    ShmQueue<record>::unlink(name);
+    ShmQueue<record> queue(name, 64);
+
+    pid_t pid = ::fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+        try {
+            ShmQueue<record> producer(name, 64);
+            for (int i = 0; i < n; ++i) {
+                while (!producer.try_push({1, i})) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        catch (...) {
+            ::_exit(1);
+        }
+        ::_exit(0);
+    }
+
+    bool ordered = true;
+    for (int i = 0; i < n; ++i) {
+        record r{};
+        while (!queue.try_pop(r)) {
+            std::this_thread::yield();
+        }
+        ordered = ordered && r.producer == 1 && r.seq == i;
+    }
+    REQUIRE(ordered);
+    REQUIRE(wait_ok(pid));
+    REQUIRE(queue.size() == 0);
+    ShmQueue<record>::unlink(name);
+}
+
+TEST_CASE("[ShmQueue] mpsc between processes")
+{
+    using namespace containers;
+
+    using Queue = ShmQueue<record, QueueMode::mpsc>;
+
+    const int nproducers = 4;
+    const int n = 25000;
+    auto name = shm_name("mpsc");
+    Queue::unlink(name);
+    Queue queue(name, 64);
+
+    std::vector<pid_t> pids;
+    for (int p = 0; p < nproducers; ++p) {
+        pid_t pid = ::fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            try {
+                Queue producer(name, 64);
+                for (int i = 0; i < n; ++i) {
+                    while (!producer.try_push({p, i})) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+            catch (...) {
+                ::_exit(1);
+            }
+            ::_exit(0);
+        }
+        pids.push_back(pid);
+    }
+
+    // Records from each producer arrive in the order they were pushed.
+    std::vector<int> next(nproducers, 0);
+    bool ordered = true;
+    for (int i = 0; i < nproducers*n; ++i) {
+        record r{};
+        while (!queue.try_pop(r)) {
+            std::this_thread::yield();
+        }
+        ordered = ordered && r.seq == next[r.producer]++;
+    }
+    REQUIRE(ordered);
+    for (auto pid : pids) {
+        REQUIRE(wait_ok(pid));
+    }
+    REQUIRE(next == std::vector<int>(nproducers, n));
+    Queue::unlink(name);
+}
+
+TEST_CASE("[ShmQueue] recover from crashed initializer")
+{
+    using namespace containers;
+
+    auto name = shm_name("crash");
+    ShmQueue<record>::unlink(name);
+
+    // Obtain the pid of a process which no longer exists.
+    pid_t dead = ::fork();
+    REQUIRE(dead >= 0);
+    if (dead == 0) {
+        ::_exit(0);
+    }
+    REQUIRE(wait_ok(dead));
+
+    // Leave the object as if dead had crashed during initialization.
+    {
+        auto nbytes = ShmQueue<record>::region_size(16);
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+        REQUIRE(fd >= 0);
+        REQUIRE(::ftruncate(fd, nbytes) == 0);
+        void* addr = ::mmap(nullptr, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        REQUIRE(addr != MAP_FAILED);
+        std::memset(addr, 0xff, nbytes);
+        auto init = static_cast<std::atomic<std::uint64_t>*>(addr);
+        init->store(std::uint64_t(dead) << 1);
+        ::munmap(addr, nbytes);
+    }
+
+    ShmQueue<record> queue(name, 16);
+    REQUIRE(queue.size() == 0);
+    record r{};
+    REQUIRE_FALSE(queue.try_pop(r));
+    REQUIRE(queue.try_push({0, 42}));
+    REQUIRE(queue.try_pop(r));
+    REQUIRE(r.seq == 42);
+    ShmQueue<record>::unlink(name);
+}
@@ -0,0 +1,581 @@
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/deque.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// block_elems returns the default number of elements in a block
+// of a BlockDeque, chosen so that a block is about 4 KiB.
+template <typename T>
+constexpr std::size_t block_elems()
+{
+    return sizeof(T) < 256 ? 4096/sizeof(T) : 16;
+}
+
+// BlockDeque is a double ended queue stored as a map of fixed size blocks.
+// Push and pop at either end are amortized constant time, elements are
+// accessed by index in constant time and a block is released as soon as
+// its last element is popped.
+template <typename T, std::size_t B = block_elems<T>()>
+class BlockDeque
+{
+public:
+    // Iterator is a random access iterator over a BlockDeque.
+    template <bool Const>
+    class Iterator
+    {
+    public:
+        using Container = std::conditional_t<Const, const BlockDeque, BlockDeque>;
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const T*, T*>;
+        using reference = std::conditional_t<Const, const T&, T&>;
+
+        Iterator() = default;
+        Iterator(Container* deque, std::size_t ind) : deque(deque), ind(ind) { }
+
+        // Allow conversion from iterator to const_iterator.
+        operator Iterator<true>() const
+        {
+            return Iterator<true>(deque, ind);
+        }
+
+        reference operator*() const { return (*deque)[ind]; }
+        pointer operator->() const { return &(*deque)[ind]; }
+        reference operator[](difference_type n) const { return (*deque)[ind + n]; }
+
+        Iterator& operator++() { ++ind; return *this; }
+        Iterator& operator--() { --ind; return *this; }
+        Iterator operator++(int) { auto tmp = *this; ++ind; return tmp; }
+        Iterator operator--(int) { auto tmp = *this; --ind; return tmp; }
+        Iterator& operator+=(difference_type n) { ind += n; return *this; }
+        Iterator& operator-=(difference_type n) { ind -= n; return *this; }
+        Iterator operator+(difference_type n) const { return Iterator(deque, ind + n); }
+        Iterator operator-(difference_type n) const { return Iterator(deque, ind - n); }
+        friend Iterator operator+(difference_type n, const Iterator& it) { return it + n; }
+
+        difference_type operator-(const Iterator& o) const
+        {
+            return difference_type(ind) - difference_type(o.ind);
+        }
+
+        bool operator==(const Iterator& o) const { return ind == o.ind; }
+        bool operator!=(const Iterator& o) const { return ind != o.ind; }
+        bool operator<(const Iterator& o) const { return ind < o.ind; }
+        bool operator>(const Iterator& o) const { return ind > o.ind; }
+        bool operator<=(const Iterator& o) const { return ind <= o.ind; }
+        bool operator>=(const Iterator& o) const { return ind >= o.ind; }
+
+    private:
+        Container* deque = nullptr;
+        std::size_t ind = 0;
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    BlockDeque() = default;
+
+    // BlockDeque copies other. Delegating to the default constructor means
+    // the destructor releases the elements copied so far if a copy throws.
+    BlockDeque(const BlockDeque& other) : BlockDeque()
+    {
+        for (const auto& v : other) {
+            push_back(v);
+        }
+    }
+
+    BlockDeque(BlockDeque&& other) noexcept
+    {
+        swap(other);
+    }
+
+    BlockDeque& operator=(BlockDeque other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~BlockDeque()
+    {
+        while (nelem) {
+            pop_back();
+        }
+    }
+
+    // push_back appends data to end of deque.
+    void push_back(const T& data)
+    {
+        emplace_back(data);
+    }
+
+    // emplace_back constructs a value in place at the end of deque.
+    template <typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        if (first + nelem == map.size()*B) {
+            grow_map();
+        }
+        auto slot = construct(first + nelem, std::forward<Args>(args)...);
+        ++nelem;
+        return *slot;
+    }
+
+    // push_front prepends data to the front of the deque.
+    void push_front(const T& data)
+    {
+        emplace_front(data);
+    }
+
+    // emplace_front constructs a value in place at the front of deque.
+    template <typename... Args>
+    T& emplace_front(Args&&... args)
+    {
+        if (first == 0) {
+            grow_map();
+        }
+        auto slot = construct(first - 1, std::forward<Args>(args)...);
+        --first;
+        ++nelem;
+        return *slot;
+    }
+
+    // back returns but does not remove from back of deque.
+    T& back()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"back from empty deque"};
+        }
+        return (*this)[nelem-1];
+    }
+
+    // front returns but does not remove from front of deque.
+    T& front()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"front from empty deque"};
+        }
+        return (*this)[0];
+    }
+
+    // pop_back removes but does not return from back of deque.
+    void pop_back()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"pop_back from empty deque"};
+        }
+        auto p = first + nelem - 1;
+        map[p/B][p % B].~T();
+        --nelem;
+        if (p % B == 0 || !nelem) {
+            release(p/B); // Popped the last element in the block.
+        }
+    }
+
+    // pop_front removes but does not return from front of deque.
+    void pop_front()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"pop_front from empty deque"};
+        }
+        auto p = first;
+        map[p/B][p % B].~T();
+        ++first;
+        --nelem;
+        if (first % B == 0 || !nelem) {
+            release(p/B); // Popped the last element in the block.
+        }
+    }
+
+    // operator[] returns the element at index ind without bounds checking.
+    T& operator[](std::size_t ind)
+    {
+        auto p = first + ind;
+        return map[p/B][p % B];
+    }
+
+    const T& operator[](std::size_t ind) const
+    {
+        auto p = first + ind;
+        return map[p/B][p % B];
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, nelem); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, nelem); }
+
+    // size returns number of elements in deque.
+    std::size_t size() const
+    {
+        return nelem;
+    }
+
+    // nblocks returns the number of blocks currently allocated.
+    std::size_t nblocks() const
+    {
+        return std::count_if(std::begin(map), std::end(map),
+                             [](const T* b) { return b != nullptr; });
+    }
+
+    void swap(BlockDeque& other) noexcept
+    {
+        std::swap(map, other.map);
+        std::swap(first, other.first);
+        std::swap(nelem, other.nelem);
+    }
+
+private:
+    using Alloc = std::allocator<T>;
+
+    // map holds pointers to blocks; blocks not holding elements are null.
+    std::vector<T*> map;
+
+    // first is the position of the front element, counting slots
+    // across all blocks of the map.
+    std::size_t first = 0;
+
+    // nelem is the number of elements in the deque.
+    std::size_t nelem = 0;
+
+    // block_for returns the block holding position p, allocating if needed.
+    T* block_for(std::size_t p)
+    {
+        auto& b = map[p/B];
+        if (!b) {
+            Alloc alloc;
+            b = alloc.allocate(B);
+        }
+        return b;
+    }
+
+    // construct constructs a value at position p, allocating its block if
+    // needed. A block allocated for a value whose constructor throws is
+    // released again.
+    template <typename... Args>
+    T* construct(std::size_t p, Args&&... args)
+    {
+        auto fresh = !map[p/B];
+        auto slot = block_for(p) + p % B;
+        try {
+            new (slot) T(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            if (fresh) {
+                Alloc alloc;
+                alloc.deallocate(map[p/B], B);
+                map[p/B] = nullptr;
+            }
+            throw;
+        }
+        return slot;
+    }
+
+    // release deallocates the block at index ind of the map.
+    void release(std::size_t ind)
+    {
+        Alloc alloc;
+        alloc.deallocate(map[ind], B);
+        map[ind] = nullptr;
+        if (!nelem) {
+            first = map.size()/2*B; // Restart in the middle of the map.
+        }
+    }
+
+    // grow_map recenters the blocks in use within a map with room
+    // for at least as many blocks again on either side.
+    void grow_map()
+    {
+        auto lo = first/B;
+        auto hi = nelem ? (first + nelem - 1)/B + 1 : lo;
+        auto used = hi - lo;
+        auto n = std::max<std::size_t>(8, 3*std::max<std::size_t>(used, 1));
+        std::vector<T*> grown(n, nullptr);
+        auto offset = (n - used)/2;
+        std::copy(std::begin(map) + lo, std::begin(map) + hi, std::begin(grown) + offset);
+        first = offset*B + first % B;
+        if (!nelem) {
+            first = n/2*B;
+        }
+        map.swap(grown);
+    }
+};
+
+}
+
+TEST_CASE("[BlockDeque]")
+{
+    using namespace containers;
+
+    using T = int;
+    BlockDeque<T, 4> deque;
+    REQUIRE(deque.size() == 0);
+    REQUIRE_THROWS_AS(deque.pop_back(), deque_empty_error);
+    REQUIRE_THROWS_AS(deque.pop_front(), deque_empty_error);
+    REQUIRE_THROWS_AS(deque.front(), deque_empty_error);
+    REQUIRE_THROWS_AS(deque.back(), deque_empty_error);
+
+    deque.push_front(1); // 1
+    REQUIRE(deque.front() == 1);
+    REQUIRE(deque.back() == 1);
+    REQUIRE(deque.size() == 1);
+
+    deque.push_front(2); // 2 1
+    REQUIRE(deque.front() == 2);
+    REQUIRE(deque.back() == 1);
+    REQUIRE(deque.size() == 2);
+
+    deque.push_back(3); // 2 1 3
+    REQUIRE(deque.front() == 2);
+    REQUIRE(deque.back() == 3);
+    REQUIRE(deque.size() == 3);
+
+    deque.pop_front(); // 1 3
+    REQUIRE(deque.front() == 1);
+    REQUIRE(deque.back() == 3);
+
+    deque.pop_back(); // 1
+    REQUIRE(deque.front() == 1);
+    REQUIRE(deque.back() == 1);
+
+    deque.pop_back(); // nil
+    REQUIRE(deque.size() == 0);
+    REQUIRE(deque.nblocks() == 0);
+}
+
+TEST_CASE("[BlockDeque] random access")
+{
+    using namespace containers;
+
+    using T = int;
+    BlockDeque<T, 4> deque;
+    std::deque<T> expected;
+    for (int i = 0; i < 50; ++i) {
+        if (i % 3 == 0) {
+            deque.push_front(i);
+            expected.push_front(i);
+        }
+        else {
+            deque.push_back(i);
+            expected.push_back(i);
+        }
+    }
+    REQUIRE(deque.size() == expected.size());
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(deque[i] == expected[i]);
+    }
+    REQUIRE(std::vector<T>(deque.begin(), deque.end())
+            == std::vector<T>(expected.begin(), expected.end()));
+
+    // Iterators support the random access algorithms.
+    std::sort(deque.begin(), deque.end());
+    REQUIRE(std::is_sorted(deque.begin(), deque.end()));
+    REQUIRE(*(deque.end() - 1) == 49);
+    REQUIRE(deque.begin()[0] == 0);
+
+    const auto& cdeque = deque;
+    REQUIRE(std::distance(cdeque.begin(), cdeque.end()) == 50);
+
+    auto copy = deque;
+    REQUIRE(std::equal(copy.begin(), copy.end(), deque.begin(), deque.end()));
+}
+
+TEST_CASE("[BlockDeque] releases blocks")
+{
+    using namespace containers;
+
+    using T = int;
+    BlockDeque<T, 4> deque;
+    for (int i = 0; i < 16; ++i) {
+        deque.push_back(i);
+    }
+    REQUIRE(deque.nblocks() <= 5);
+
+    // Each block is released as soon as its last element is popped.
+    for (int i = 0; i < 8; ++i) {
+        deque.pop_front();
+    }
+    REQUIRE(deque.nblocks() <= 3);
+    for (int i = 0; i < 7; ++i) {
+        deque.pop_back();
+    }
+    REQUIRE(deque.nblocks() == 1);
+    REQUIRE(deque.front() == 8);
+    deque.pop_back();
+    REQUIRE(deque.nblocks() == 0);
+
+    // A sliding window keeps a bounded number of blocks.
+    for (int i = 0; i < 1000; ++i) {
+        deque.push_back(i);
+        if (deque.size() > 10) {
+            deque.pop_front();
+        }
+    }
+    REQUIRE(deque.size() == 10);
+    REQUIRE(deque.front() == 990);
+    REQUIRE(deque.nblocks() <= 4);
+}
+
+TEST_CASE("[BlockDeque] constructor throws")
+{
+    using namespace containers;
+
+    // Throwing is constructed from a negative value by throwing.
+    struct Throwing
+    {
+        Throwing(int v) : v(v)
+        {
+            if (v < 0) {
+                throw std::invalid_argument{"negative"};
+            }
+        }
+
+        int v;
+    };
+
+    BlockDeque<Throwing, 4> deque;
+    REQUIRE_THROWS_AS(deque.emplace_back(-1), std::invalid_argument);
+    REQUIRE_THROWS_AS(deque.emplace_front(-1), std::invalid_argument);
+    REQUIRE(deque.size() == 0);
+    REQUIRE(deque.nblocks() == 0);
+
+    // A block full of values is kept, the block allocated for the failed
+    // value is released.
+    for (int i = 0; i < 4; ++i) {
+        deque.emplace_back(i);
+    }
+    auto nblocks = deque.nblocks();
+    REQUIRE_THROWS_AS(deque.emplace_back(-1), std::invalid_argument);
+    REQUIRE_THROWS_AS(deque.emplace_front(-1), std::invalid_argument);
+    REQUIRE(deque.nblocks() == nblocks);
+    REQUIRE(deque.size() == 4);
+    REQUIRE(deque.front().v == 0);
+    REQUIRE(deque.back().v == 3);
+
+    deque.emplace_back(4);
+    deque.emplace_front(5);
+    REQUIRE(deque.size() == 6);
+    REQUIRE(deque.front().v == 5);
+    REQUIRE(deque.back().v == 4);
+}
+
+TEST_CASE("[BlockDeque] copy throws")
+{
+    using namespace containers;
+
+    // CopyThrows throws when a negative value is copied. Every value
+    // shares live, so its use count is the number of values alive.
+    struct CopyThrows
+    {
+        CopyThrows(int v, std::shared_ptr<int> live) : v(v), live(std::move(live)) { }
+
+        CopyThrows(const CopyThrows& other) : v(other.v), live(other.live)
+        {
+            if (v < 0) {
+                throw std::invalid_argument{"negative"};
+            }
+        }
+
+        int v;
+        std::shared_ptr<int> live;
+    };
+
+    using Deque = BlockDeque<CopyThrows, 4>;
+    auto live = std::make_shared<int>(0);
+    Deque deque;
+    for (int i = 0; i < 10; ++i) {
+        deque.emplace_back(i, live);
+    }
+    deque.emplace_back(-1, live);
+    deque.emplace_back(11, live);
+    REQUIRE(live.use_count() == 13);
+
+    // The values copied before the throw are destroyed again.
+    REQUIRE_THROWS_AS(Deque{deque}, std::invalid_argument);
+    REQUIRE(live.use_count() == 13);
+
+    deque.pop_back();
+    deque.pop_back();
+    Deque copy(deque);
+    REQUIRE(copy.size() == 10);
+    REQUIRE(live.use_count() == 21);
+}
+
+TEST_CASE("[BlockDeque] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1000000;
+
+    // churn pushes n values at both ends and pops them again.
+    auto churn = [](auto& deque) {
+        for (int i = 0; i < n; ++i) {
+            deque.push_back(i);
+            deque.push_front(i);
+        }
+        long sum = 0;
+        for (int i = 0; i < n; ++i) {
+            sum += deque.back();
+            deque.pop_back();
+            sum += deque.front();
+            deque.pop_front();
+        }
+        do_not_optimize(sum);
+    };
+
+    {
+        Deque<int> deque;
+        MESSAGE("Deque push/pop: " << elapsed_ms([&] { churn(deque); }) << " ms");
+    }
+    {
+        BlockDeque<int> deque;
+        MESSAGE("BlockDeque push/pop: " << elapsed_ms([&] { churn(deque); }) << " ms");
+    }
+    {
+        std::deque<int> deque;
+        MESSAGE("std::deque push/pop: " << elapsed_ms([&] { churn(deque); }) << " ms");
+    }
+
+    // index sums every element by position.
+    auto index = [](auto& deque) {
+        long sum = 0;
+        for (std::size_t i = 0; i < deque.size(); ++i) {
+            sum += deque[i];
+        }
+        do_not_optimize(sum);
+    };
+
+    {
+        BlockDeque<int> deque;
+        for (int i = 0; i < n; ++i) {
+            deque.push_back(i);
+        }
+        MESSAGE("BlockDeque operator[]: " << elapsed_ms([&] { index(deque); }) << " ms");
+    }
+    {
+        std::deque<int> deque;
+        for (int i = 0; i < n; ++i) {
+            deque.push_back(i);
+        }
+        MESSAGE("std::deque operator[]: " << elapsed_ms([&] { index(deque); }) << " ms");
+    }
+}
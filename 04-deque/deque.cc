@@ -1,130 +1,7 @@
-#include <cstddef>
-#include <memory>
-#include <stdexcept>
-
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest/doctest.h"
 
-namespace containers
-{
-
-struct deque_empty_error : std::runtime_error
-{
-    using std::runtime_error::runtime_error;
-};
-
-// node is a node in a double linked list.
-template <typename T>
-struct node
-{
-    node() = default;
-    node(const T& data) : data(data) { }
-    T data;
-    std::unique_ptr<node<T>> next;
-    node<T>* prev;
-};
-
-// Deque is a double ended queue that provides constant time front and back.
-// You can think of the interface as the union of a Stack and Queue.
-template <typename T>
-class Deque
-{
-public:
-    Deque() = default;
-
-    // push_back appends data to end of deque.
-    void push_back(const T& data)
-    {
-        if (!head) {
-            head = std::make_unique<node<T>>(data);
-            tail = head.get();
-        }
-        else {
-            tail->next = std::make_unique<node<T>>(data);
-            tail->next->prev = tail;
-            tail = tail->next.get();
-        }
-        ++nelem;
-    }
-
-    // back returns but does not remove from back of deque.
-    T& back()
-    {
-        if (!nelem) {
-            throw deque_empty_error{"back from empty deuqe"};
-        }
-        return tail->data;
-    }
-
-    // pop_back removes but does not return from back of deque.
-    void pop_back()
-    {
-        if (!nelem) {
-            throw deque_empty_error{"pop_back from empty deque"};
-        }
-        if (head.get() == tail) {
-            head = nullptr;
-            tail = nullptr;
-        }
-        else {
-            tail = tail->prev;
-        }
-        --nelem;
-    }
-
-    // push_front prepends data to the front of the deque.
-    void push_front(const T& data)
-    {
-        if (!head) {
-            head = std::make_unique<node<T>>(data);
-            tail = head.get();
-        }
-        else {
-            auto tmp = std::make_unique<node<T>>(data);
-            tmp->next = std::move(head);
-            head = std::move(tmp);
-        }
-        ++nelem;
-    }
-
-    // front returns but does not remove from front of deque.
-    T& front()
-    {
-        if (!nelem) {
-            throw deque_empty_error{"front from empty deque"};
-        }
-        return head->data;
-    }
-
-    // pop_front removes but does not return from front of deque.
-    void pop_front()
-    {
-        if (!nelem) {
-            throw deque_empty_error{"pop_front from empty deque"};
-        }
-        if (head.get() == tail) {
-            head = nullptr;
-            tail = nullptr;
-        }
-        else {
-            head = std::move(head->next);
-        }
-        --nelem;
-    }
-
-    // size returns number of elements in deque.
-    std::size_t size() const
-    {
-        return nelem;
-    }
-
-private:
-    std::unique_ptr<node<T>> head;
-    node<T>* tail;
-    std::size_t nelem = 0;
-};
-
-}
+#include "containers/deque.h"
 
 TEST_CASE("[Deque]")
 {
@@ -192,3 +69,91 @@ TEST_CASE("[Deque]")
     deque.pop_back(); // nil
     REQUIRE(deque.size() == 0);
 }
+
+TEST_CASE("[Deque] push_front links prev")
+{
+    using namespace containers;
+
+    using T = int;
+    Deque<T> deque;
+    for (int i = 0; i < 4; ++i) {
+        deque.push_front(i); // 3 2 1 0
+    }
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE(deque.back() == i);
+        deque.pop_back();
+    }
+    REQUIRE(deque.size() == 0);
+
+    deque.push_back(1);
+    deque.push_front(0);
+    deque.pop_front(); // 1
+    deque.push_front(2); // 2 1
+    deque.pop_back(); // 2
+    REQUIRE(deque.front() == 2);
+    REQUIRE(deque.back() == 2);
+    REQUIRE(deque.size() == 1);
+}
+
+TEST_CASE("[Deque] move only elements")
+{
+    using namespace containers;
+
+    using T = std::unique_ptr<int>;
+    Deque<T> deque;
+    deque.push_back(std::make_unique<int>(1)); // 1
+    deque.push_front(std::make_unique<int>(0)); // 0 1
+    REQUIRE(*deque.emplace_back(new int(2)) == 2); // 0 1 2
+    REQUIRE(*deque.emplace_front(new int(-1)) == -1); // -1 0 1 2
+    REQUIRE(deque.size() == 4);
+
+    auto v = std::move(deque.back());
+    deque.pop_back();
+    REQUIRE(*v == 2);
+    REQUIRE(*deque.front() == -1);
+    REQUIRE(*deque.back() == 1);
+
+    Deque<T> moved(std::move(deque));
+    REQUIRE(moved.size() == 3);
+    REQUIRE(deque.size() == 0);
+    REQUIRE(*moved.front() == -1);
+}
+
+TEST_CASE("[Deque] reuses popped nodes")
+{
+    using namespace containers;
+
+    using T = int;
+    Deque<T> deque;
+    deque.push_back(1);
+    const T* addr = &deque.back();
+
+    // Steady state push and pop churn through the same node.
+    for (int i = 0; i < 10; ++i) {
+        deque.pop_back();
+        deque.push_front(i);
+        REQUIRE(&deque.front() == addr);
+        deque.pop_front();
+        deque.push_back(i);
+        REQUIRE(&deque.back() == addr);
+    }
+
+    deque.pop_back();
+    deque.shrink_to_fit();
+    REQUIRE(deque.size() == 0);
+}
+
+TEST_CASE("[Deque] destroy long deque")
+{
+    using namespace containers;
+
+    // Deep enough to overflow the stack if nodes were destroyed recursively.
+    Deque<int> deque;
+    for (int i = 0; i < 2000000; ++i) {
+        deque.push_back(i);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        deque.pop_front(); // Populate the free list as well.
+    }
+    REQUIRE(deque.size() == 1999000);
+}
@@ -0,0 +1,539 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/deque.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// Span is a view of contiguous elements.
+template <typename T>
+struct Span
+{
+    T* data;
+    std::size_t size;
+
+    T* begin() const { return data; }
+    T* end() const { return data + size; }
+};
+
+// RingDeque is a double ended queue stored in a contiguous circular buffer.
+// Ranges of elements are pushed or popped at either end with at most two
+// contiguous copies, which are a memcpy when T is trivially copyable.
+template <typename T>
+class RingDeque
+{
+public:
+    RingDeque() = default;
+
+    RingDeque(const RingDeque& other)
+    {
+        reserve(other.size());
+        auto s = other.spans();
+        push_back_range(s.first.data, s.first.size);
+        push_back_range(s.second.data, s.second.size);
+    }
+
+    RingDeque(RingDeque&& other) noexcept
+    {
+        swap(other);
+    }
+
+    RingDeque& operator=(RingDeque other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~RingDeque()
+    {
+        pop_front_n(nelem);
+        Alloc alloc;
+        alloc.deallocate(buf, cap);
+    }
+
+    // push_back appends data to end of deque. data may be an element of
+    // the deque: when the buffer grows, the copy is made in the new buffer
+    // before the elements are moved out of the old one.
+    void push_back(const T& data)
+    {
+        if (nelem == cap) {
+            auto tmp = grown(nelem + 1);
+            new (tmp.buf + nelem) T(data);
+            tmp.take(*this);
+            ++tmp.nelem;
+            swap(tmp);
+            return;
+        }
+        new (buf + wrap(head + nelem)) T(data);
+        ++nelem;
+    }
+
+    // push_front prepends data to the front of the deque. data may be an
+    // element of the deque.
+    void push_front(const T& data)
+    {
+        if (nelem == cap) {
+            auto tmp = grown(nelem + 1);
+            new (tmp.buf + tmp.cap - 1) T(data);
+            tmp.take(*this);
+            tmp.head = tmp.cap - 1;
+            ++tmp.nelem;
+            swap(tmp);
+            return;
+        }
+        auto h = wrap(head + cap - 1);
+        new (buf + h) T(data);
+        head = h;
+        ++nelem;
+    }
+
+    // push_back_range appends n values from data to end of deque. data
+    // may point into the deque.
+    void push_back_range(const T* data, std::size_t n)
+    {
+        if (nelem + n > cap) {
+            auto tmp = grown(nelem + n);
+            tmp.copy_in(data, n, nelem);
+            tmp.take(*this);
+            tmp.nelem += n;
+            swap(tmp);
+            return;
+        }
+        copy_in(data, n, wrap(head + nelem));
+        nelem += n;
+    }
+
+    // push_front_range prepends n values from data to the front of the
+    // deque; data[0] becomes the front. data may point into the deque.
+    void push_front_range(const T* data, std::size_t n)
+    {
+        if (nelem + n > cap) {
+            auto tmp = grown(nelem + n);
+            tmp.copy_in(data, n, tmp.cap - n);
+            tmp.take(*this);
+            tmp.head = tmp.cap - n;
+            tmp.nelem += n;
+            swap(tmp);
+            return;
+        }
+        auto h = wrap(head + cap - n);
+        copy_in(data, n, h);
+        head = h;
+        nelem += n;
+    }
+
+    // back returns but does not remove from back of deque.
+    T& back()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"back from empty deque"};
+        }
+        return buf[wrap(head + nelem - 1)];
+    }
+
+    // front returns but does not remove from front of deque.
+    T& front()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"front from empty deque"};
+        }
+        return buf[head];
+    }
+
+    // pop_back removes but does not return from back of deque.
+    void pop_back()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"pop_back from empty deque"};
+        }
+        pop_back_n(1);
+    }
+
+    // pop_front removes but does not return from front of deque.
+    void pop_front()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"pop_front from empty deque"};
+        }
+        pop_front_n(1);
+    }
+
+    // pop_back_n removes n elements from the back of deque.
+    void pop_back_n(std::size_t n)
+    {
+        if (n > nelem) {
+            throw deque_empty_error{"pop_back_n past front of deque"};
+        }
+        destroy(wrap(head + nelem - n), n);
+        nelem -= n;
+    }
+
+    // pop_front_n removes n elements from the front of deque.
+    void pop_front_n(std::size_t n)
+    {
+        if (n > nelem) {
+            throw deque_empty_error{"pop_front_n past back of deque"};
+        }
+        destroy(head, n);
+        head = wrap(head + n);
+        nelem -= n;
+    }
+
+    // operator[] returns the element at index ind without bounds checking.
+    T& operator[](std::size_t ind)
+    {
+        return buf[wrap(head + ind)];
+    }
+
+    const T& operator[](std::size_t ind) const
+    {
+        return buf[wrap(head + ind)];
+    }
+
+    // spans returns the elements of the deque in order as two contiguous
+    // views; the second is empty unless the elements wrap around.
+    std::pair<Span<T>, Span<T>> spans()
+    {
+        auto first = std::min(nelem, cap - head);
+        return {{buf + head, first}, {buf, nelem - first}};
+    }
+
+    std::pair<Span<const T>, Span<const T>> spans() const
+    {
+        auto first = std::min(nelem, cap - head);
+        return {{buf + head, first}, {buf, nelem - first}};
+    }
+
+    // reserve grows the buffer to hold at least n elements.
+    void reserve(std::size_t n)
+    {
+        if (n <= cap) {
+            return;
+        }
+        auto tmp = grown(n);
+        tmp.take(*this);
+        swap(tmp);
+    }
+
+    // size returns number of elements in deque.
+    std::size_t size() const
+    {
+        return nelem;
+    }
+
+    // capacity returns the number of elements the buffer holds.
+    std::size_t capacity() const
+    {
+        return cap;
+    }
+
+    void swap(RingDeque& other) noexcept
+    {
+        std::swap(buf, other.buf);
+        std::swap(cap, other.cap);
+        std::swap(head, other.head);
+        std::swap(nelem, other.nelem);
+    }
+
+private:
+    using Alloc = std::allocator<T>;
+
+    T* buf = nullptr;
+    std::size_t cap = 0; // Always 0 or a power of 2.
+    std::size_t head = 0;
+    std::size_t nelem = 0;
+
+    std::size_t wrap(std::size_t ind) const
+    {
+        return ind & (cap - 1);
+    }
+
+    // grown returns an empty deque whose buffer holds at least n elements,
+    // and more than this one.
+    RingDeque grown(std::size_t n) const
+    {
+        std::size_t c = cap ? cap : 8;
+        while (c < n) {
+            c *= 2;
+        }
+        RingDeque tmp;
+        Alloc alloc;
+        tmp.buf = alloc.allocate(c);
+        tmp.cap = c;
+        return tmp;
+    }
+
+    // take moves the elements of other to the front of the buffer, leaving
+    // other with its buffer but no elements.
+    void take(RingDeque& other)
+    {
+        auto s = other.spans();
+        move_in(s.first.data, s.first.size, 0);
+        move_in(s.second.data, s.second.size, s.first.size);
+        nelem = other.nelem;
+        other.nelem = 0;
+    }
+
+    // copy_in copies n values from src into the buffer starting at ind.
+    void copy_in(const T* src, std::size_t n, std::size_t ind)
+    {
+        auto first = std::min(n, cap - ind);
+        copy(src, first, buf + ind);
+        copy(src + first, n - first, buf);
+    }
+
+    // move_in moves n values from src into the buffer starting at ind.
+    void move_in(T* src, std::size_t n, std::size_t ind)
+    {
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            copy_in(src, n, ind);
+            return;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            new (buf + wrap(ind + i)) T(std::move(src[i]));
+            src[i].~T();
+        }
+    }
+
+    static void copy(const T* src, std::size_t n, T* dst)
+    {
+        if (!n) {
+            return;
+        }
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            std::memcpy(static_cast<void*>(dst), src, n*sizeof(T));
+        }
+        else {
+            std::uninitialized_copy_n(src, n, dst);
+        }
+    }
+
+    // destroy ends the lifetime of n elements starting at ind.
+    void destroy(std::size_t ind, std::size_t n)
+    {
+        if constexpr (std::is_trivially_destructible<T>::value) {
+            return;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            buf[wrap(ind + i)].~T();
+        }
+    }
+};
+
+}
+
+TEST_CASE("[RingDeque]")
+{
+    using namespace containers;
+
+    using T = int;
+    RingDeque<T> deque;
+    REQUIRE(deque.size() == 0);
+    REQUIRE_THROWS_AS(deque.pop_back(), deque_empty_error);
+    REQUIRE_THROWS_AS(deque.pop_front(), deque_empty_error);
+
+    deque.push_front(1); // 1
+    REQUIRE(deque.front() == 1);
+    REQUIRE(deque.back() == 1);
+    REQUIRE(deque.size() == 1);
+
+    deque.push_front(2); // 2 1
+    REQUIRE(deque.front() == 2);
+    REQUIRE(deque.back() == 1);
+
+    deque.push_back(3); // 2 1 3
+    REQUIRE(deque.front() == 2);
+    REQUIRE(deque.back() == 3);
+    REQUIRE(deque.size() == 3);
+
+    deque.pop_front(); // 1 3
+    REQUIRE(deque.front() == 1);
+
+    deque.pop_back(); // 1
+    REQUIRE(deque.back() == 1);
+
+    deque.pop_back(); // nil
+    REQUIRE(deque.size() == 0);
+    REQUIRE_THROWS_AS(deque.front(), deque_empty_error);
+}
+
+TEST_CASE("[RingDeque] ranges")
+{
+    using namespace containers;
+
+    using T = int;
+    RingDeque<T> deque;
+    std::deque<T> expected;
+
+    // values returns the deque contents by reading both spans.
+    auto values = [](const RingDeque<T>& d) {
+        std::vector<T> v;
+        auto s = d.spans();
+        v.insert(v.end(), s.first.begin(), s.first.end());
+        v.insert(v.end(), s.second.begin(), s.second.end());
+        return v;
+    };
+
+    std::vector<T> input(100);
+    for (int round = 0; round < 50; ++round) {
+        for (std::size_t i = 0; i < input.size(); ++i) {
+            input[i] = round*1000 + int(i);
+        }
+        auto n = 10 + round % 37;
+        if (round % 2) {
+            deque.push_back_range(input.data(), n);
+            expected.insert(expected.end(), input.begin(), input.begin() + n);
+        }
+        else {
+            deque.push_front_range(input.data(), n);
+            expected.insert(expected.begin(), input.begin(), input.begin() + n);
+        }
+        auto m = 5 + round % 23;
+        if (round % 3) {
+            deque.pop_front_n(m);
+            expected.erase(expected.begin(), expected.begin() + m);
+        }
+        else {
+            deque.pop_back_n(m);
+            expected.erase(expected.end() - m, expected.end());
+        }
+        REQUIRE(values(deque) == std::vector<T>(expected.begin(), expected.end()));
+    }
+    REQUIRE(deque.size() == expected.size());
+    REQUIRE(deque[0] == expected.front());
+    REQUIRE(deque[deque.size()-1] == expected.back());
+    REQUIRE_THROWS_AS(deque.pop_front_n(deque.size()+1), deque_empty_error);
+
+    auto copy = deque;
+    REQUIRE(values(copy) == values(deque));
+    deque.pop_back_n(deque.size());
+    REQUIRE(deque.size() == 0);
+    REQUIRE(values(deque).empty());
+}
+
+TEST_CASE("[RingDeque] non trivial elements")
+{
+    using namespace containers;
+
+    using T = std::string;
+    RingDeque<T> deque;
+    std::vector<T> input{"a", "b", "c", "d", "e"};
+    for (int i = 0; i < 10; ++i) {
+        deque.push_back_range(input.data(), input.size());
+        deque.push_front_range(input.data(), input.size());
+        deque.pop_front_n(3);
+    }
+    REQUIRE(deque.size() == 70);
+    REQUIRE(deque.front() == "d");
+    REQUIRE(deque.back() == "e");
+    deque.pop_back_n(4);
+    REQUIRE(deque.back() == "a");
+}
+
+TEST_CASE("[RingDeque] push an element of the deque")
+{
+    using namespace containers;
+
+    // Each push fills the buffer, so the next one grows it while its
+    // argument refers to an element.
+    using T = std::string;
+    auto make_full = [] {
+        RingDeque<T> deque;
+        deque.reserve(8);
+        for (int i = 0; i < 8; ++i) {
+            deque.push_back(std::string(32, char('a' + i)));
+        }
+        REQUIRE(deque.size() == deque.capacity());
+        return deque;
+    };
+
+    auto deque = make_full();
+    deque.push_back(deque.front());
+    REQUIRE(deque.back() == std::string(32, 'a'));
+    REQUIRE(deque.front() == std::string(32, 'a'));
+
+    deque = make_full();
+    deque.push_front(deque.back());
+    REQUIRE(deque.front() == std::string(32, 'h'));
+    REQUIRE(deque.back() == std::string(32, 'h'));
+    REQUIRE(deque.size() == 9);
+
+    deque = make_full();
+    auto s = deque.spans();
+    deque.push_back_range(s.first.data, s.first.size);
+    REQUIRE(deque.size() == 16);
+    for (std::size_t i = 0; i < 8; ++i) {
+        REQUIRE(deque[i + 8] == deque[i]);
+    }
+
+    deque = make_full();
+    s = deque.spans();
+    deque.push_front_range(s.first.data + 4, 4);
+    REQUIRE(deque.size() == 12);
+    REQUIRE(deque.front() == std::string(32, 'e'));
+    REQUIRE(deque[3] == std::string(32, 'h'));
+    REQUIRE(deque[4] == std::string(32, 'a'));
+}
+
+TEST_CASE("[RingDeque] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    // A sliding window which appends and trims batches at both ends.
+    const int rounds = 20000;
+    const std::size_t batch = 500;
+    std::vector<int> input(batch, 1);
+
+    {
+        Deque<int> deque;
+        auto ms = elapsed_ms([&] {
+            for (int r = 0; r < rounds; ++r) {
+                for (auto v : input) {
+                    deque.push_back(v);
+                }
+                for (std::size_t i = 0; i < batch; ++i) {
+                    deque.pop_front();
+                }
+            }
+        });
+        MESSAGE("Deque window: " << ms << " ms");
+    }
+    {
+        std::deque<int> deque;
+        auto ms = elapsed_ms([&] {
+            for (int r = 0; r < rounds; ++r) {
+                deque.insert(deque.end(), input.begin(), input.end());
+                deque.erase(deque.begin(), deque.begin() + batch);
+            }
+        });
+        MESSAGE("std::deque window: " << ms << " ms");
+    }
+    {
+        RingDeque<int> deque;
+        auto ms = elapsed_ms([&] {
+            for (int r = 0; r < rounds; ++r) {
+                deque.push_back_range(input.data(), batch);
+                deque.pop_front_n(batch);
+            }
+        });
+        do_not_optimize(deque.size());
+        MESSAGE("RingDeque window: " << ms << " ms");
+    }
+}
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/work_stealing.h"
+
+namespace
+{
+
+// fib returns the nth fibonacci number computed by fork-join.
+long fib(containers::TaskPool& pool, int n)
+{
+    if (n < 2) {
+        return n;
+    }
+    long x = 0;
+    long y = 0;
+    pool.invoke([&] { x = fib(pool, n-1); }, [&] { y = fib(pool, n-2); });
+    return x + y;
+}
+
+// tnode is a node in the binary tree used by the benchmark.
+struct tnode
+{
+    std::unique_ptr<tnode> left;
+    std::unique_ptr<tnode> right;
+};
+
+// make_complete returns a complete binary tree of the given height.
+std::unique_ptr<tnode> make_complete(int height)
+{
+    auto root = std::make_unique<tnode>();
+    if (height > 0) {
+        root->left = make_complete(height-1);
+        root->right = make_complete(height-1);
+    }
+    return root;
+}
+
+std::size_t tree_size(const tnode* root)
+{
+    if (!root) {
+        return 0;
+    }
+    return 1 + tree_size(root->left.get()) + tree_size(root->right.get());
+}
+
+// parallel_tree_size forks at every node above cutoff depth.
+std::size_t parallel_tree_size(containers::TaskPool& pool, const tnode* root, int cutoff)
+{
+    if (!root) {
+        return 0;
+    }
+    if (cutoff == 0) {
+        return tree_size(root);
+    }
+    std::size_t left = 0;
+    std::size_t right = 0;
+    pool.invoke(
+        [&] { left = parallel_tree_size(pool, root->left.get(), cutoff-1); },
+        [&] { right = parallel_tree_size(pool, root->right.get(), cutoff-1); });
+    return 1 + left + right;
+}
+
+}
+
+TEST_CASE("[WorkStealingDeque]")
+{
+    using namespace containers;
+
+    using T = int;
+    WorkStealingDeque<T> deque(4);
+    T v = 0;
+    REQUIRE(deque.size() == 0);
+    REQUIRE_FALSE(deque.pop(v));
+    REQUIRE_FALSE(deque.steal(v));
+
+    // Grows past the initial capacity.
+    for (int i = 0; i < 100; ++i) {
+        deque.push(i);
+    }
+    REQUIRE(deque.size() == 100);
+    REQUIRE(deque.capacity() >= 100);
+
+    // Owner pops LIFO, thieves steal FIFO.
+    REQUIRE(deque.pop(v));
+    REQUIRE(v == 99);
+    REQUIRE(deque.steal(v));
+    REQUIRE(v == 0);
+    REQUIRE(deque.steal(v));
+    REQUIRE(v == 1);
+    REQUIRE(deque.pop(v));
+    REQUIRE(v == 98);
+    REQUIRE(deque.size() == 96);
+
+    while (deque.pop(v)) {
+    }
+    REQUIRE(deque.size() == 0);
+    REQUIRE_FALSE(deque.steal(v));
+}
+
+TEST_CASE("[WorkStealingDeque] concurrent steal")
+{
+    using namespace containers;
+
+    const int n = 200000;
+    const int nthieves = 3;
+    WorkStealingDeque<int> deque(8);
+    std::vector<std::atomic<int>> taken(n);
+    std::atomic<bool> done{false};
+
+    std::vector<std::thread> thieves;
+    for (int i = 0; i < nthieves; ++i) {
+        thieves.emplace_back([&] {
+            int v = 0;
+            while (!done.load()) {
+                if (deque.steal(v)) {
+                    taken[v].fetch_add(1);
+                }
+            }
+        });
+    }
+
+    // The owner interleaves pushes and pops while thieves steal.
+    int v = 0;
+    for (int i = 0; i < n; ++i) {
+        deque.push(i);
+        if (i % 3 == 0 && deque.pop(v)) {
+            taken[v].fetch_add(1);
+        }
+    }
+    while (deque.pop(v)) {
+        taken[v].fetch_add(1);
+    }
+    while (deque.size()) {
+        std::this_thread::yield();
+    }
+    done = true;
+    for (auto& t : thieves) {
+        t.join();
+    }
+
+    // Every element is taken exactly once.
+    bool once = std::all_of(std::begin(taken), std::end(taken),
+                            [](const std::atomic<int>& c) { return c.load() == 1; });
+    REQUIRE(once);
+}
+
+TEST_CASE("[TaskPool]")
+{
+    using namespace containers;
+
+    for (std::size_t nthreads : {1, 2, 4}) {
+        TaskPool pool(nthreads);
+        REQUIRE(pool.size() == nthreads);
+
+        long f = 0;
+        pool.run([&] { f = fib(pool, 20); });
+        REQUIRE(f == 6765);
+
+        // Tasks spawned from outside the pool.
+        std::atomic<int> sum{0};
+        {
+            TaskGroup group(pool);
+            for (int i = 1; i <= 100; ++i) {
+                group.spawn([&sum, i] { sum += i; });
+            }
+            group.wait();
+        }
+        REQUIRE(sum == 5050);
+
+        // Exceptions thrown by tasks are rethrown by wait.
+        TaskGroup group(pool);
+        group.spawn([] { throw std::runtime_error{"task failed"}; });
+        REQUIRE_THROWS_AS(group.wait(), std::runtime_error);
+    }
+}
+
+TEST_CASE("[TaskGroup] spawn throws")
+{
+    using namespace containers;
+
+    // CopyThrows cannot be copied into a task.
+    struct CopyThrows
+    {
+        CopyThrows() = default;
+
+        CopyThrows(const CopyThrows&)
+        {
+            throw std::runtime_error{"copy failed"};
+        }
+
+        void operator()() const { }
+    };
+
+    TaskPool pool(2);
+    TaskGroup group(pool);
+    std::atomic<int> ran{0};
+    group.spawn([&ran] { ++ran; });
+    CopyThrows f;
+    REQUIRE_THROWS_AS(group.spawn(f), std::runtime_error);
+    group.spawn([&ran] { ++ran; });
+
+    // wait returns once the tasks which were spawned have run.
+    group.wait();
+    REQUIRE(ran == 2);
+}
+
+TEST_CASE("[TaskPool] parallel tree_size")
+{
+    using namespace containers;
+
+    auto root = make_complete(12);
+    TaskPool pool(4);
+    std::size_t size = 0;
+    pool.run([&] { size = parallel_tree_size(pool, root.get(), 6); });
+    REQUIRE(size == (1u << 13) - 1);
+}
+
+TEST_CASE("[TaskPool] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    auto root = make_complete(22); // 8M nodes.
+
+    std::size_t size = 0;
+    MESSAGE("sequential tree_size: "
+            << elapsed_ms([&] { size = tree_size(root.get()); }) << " ms");
+    do_not_optimize(size);
+
+    auto nmax = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned nthreads = 1; nthreads <= nmax; nthreads *= 2) {
+        TaskPool pool(nthreads);
+        auto ms = elapsed_ms([&] {
+            pool.run([&] { size = parallel_tree_size(pool, root.get(), 10); });
+        });
+        REQUIRE(size == (1u << 23) - 1);
+        MESSAGE("parallel tree_size " << nthreads << " threads: " << ms << " ms");
+    }
+}
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/tree.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// NoSummary is the monoid used when only size and height are needed.
+template <typename T>
+struct NoSummary
+{
+    struct value_type { };
+    static value_type identity() { return {}; }
+    static value_type lift(const T&) { return {}; }
+    static value_type combine(value_type, value_type) { return {}; }
+};
+
+// SumSummary is the monoid of the sum of the values in a subtree.
+template <typename T>
+struct SumSummary
+{
+    using value_type = T;
+    static value_type identity() { return T(); }
+    static value_type lift(const T& v) { return v; }
+    static value_type combine(const T& a, const T& b) { return a + b; }
+};
+
+// AugTreeNode is a node in a binary tree which caches the size and
+// height of its subtree and the Monoid summary of the values in it.
+// Attaching a node updates the cached values on the path to the root,
+// so the cost of insert is proportional to depth and the queries are
+// constant time.
+template <typename T, typename Monoid = NoSummary<T>>
+struct AugTreeNode
+{
+    using AugTreeNodePtr = std::shared_ptr<AugTreeNode<T, Monoid>>;
+    using Summary = typename Monoid::value_type;
+
+    AugTreeNode() = default;
+
+    AugTreeNode(const T& data)
+        : data(data),
+          summary(Monoid::lift(data))
+    { }
+
+    ~AugTreeNode()
+    {
+        // A subtree still owned elsewhere becomes a tree of its own.
+        detach(left);
+        detach(right);
+    }
+
+    // insert_left replaces the left subtree with a new node holding data.
+    // A replaced subtree still owned elsewhere becomes a tree of its own.
+    AugTreeNode<T, Monoid>* insert_left(const T& data)
+    {
+        attach(left, data);
+        return left.get();
+    }
+
+    // insert_right is insert_left for the right subtree.
+    AugTreeNode<T, Monoid>* insert_right(const T& data)
+    {
+        attach(right, data);
+        return right.get();
+    }
+
+    // set_data replaces data and updates the summaries which include it.
+    void set_data(const T& v)
+    {
+        data = v;
+        update_path();
+    }
+
+    T data;
+    AugTreeNodePtr left;
+    AugTreeNodePtr right;
+    AugTreeNode<T, Monoid>* parent = nullptr;
+
+    // Cached values for the subtree rooted at this node.
+    std::size_t size = 1;
+    std::size_t height = 0;
+    Summary summary = Monoid::identity();
+
+private:
+    // attach replaces child with a new node holding data.
+    void attach(AugTreeNodePtr& child, const T& data)
+    {
+        auto node = std::make_shared<AugTreeNode<T, Monoid>>(data);
+        node->parent = this;
+        detach(child);
+        child = std::move(node);
+        update_path();
+    }
+
+    static void detach(const AugTreeNodePtr& child)
+    {
+        if (child) {
+            child->parent = nullptr;
+        }
+    }
+
+    // update_path recomputes the cached values from this node to the root.
+    void update_path()
+    {
+        for (auto node = this; node; node = node->parent) {
+            node->update();
+        }
+    }
+
+    // update recomputes the cached values from those of the children.
+    void update()
+    {
+        size = 1;
+        height = 0;
+        auto lsum = Monoid::identity();
+        auto rsum = Monoid::identity();
+        if (left) {
+            size += left->size;
+            height = std::max(height, left->height + 1);
+            lsum = left->summary;
+        }
+        if (right) {
+            size += right->size;
+            height = std::max(height, right->height + 1);
+            rsum = right->summary;
+        }
+        summary = Monoid::combine(Monoid::combine(lsum, Monoid::lift(data)), rsum);
+    }
+};
+
+// make_aug_tree returns a tree initialized in level order from values,
+// the same shape as make_tree.
+template <typename T, typename Monoid = NoSummary<T>>
+std::shared_ptr<AugTreeNode<T, Monoid>>
+make_aug_tree(const std::vector<T>& values)
+{
+    std::shared_ptr<AugTreeNode<T, Monoid>> root;
+
+    std::queue<AugTreeNode<T, Monoid>*> nodes;
+    for (const auto& v : values) {
+        if (nodes.empty()) {
+            root = std::make_shared<AugTreeNode<T, Monoid>>(v);
+            nodes.push(root.get());
+        }
+        else {
+            auto node = nodes.front();
+            if (!node->left) {
+                nodes.push(node->insert_left(v));
+            }
+            else {
+                nodes.push(node->insert_right(v));
+                nodes.pop(); // Both children populated.
+            }
+        }
+    }
+
+    return root;
+}
+
+// tree_height returns the height of the tree.
+template <typename T, typename Monoid>
+std::size_t
+tree_height(const AugTreeNode<T, Monoid>* root)
+{
+    return root ? root->height : 0;
+}
+
+// tree_size returns the number of elements in the tree.
+template <typename T, typename Monoid>
+std::size_t
+tree_size(const AugTreeNode<T, Monoid>* root)
+{
+    return root ? root->size : 0;
+}
+
+// tree_summary returns the Monoid summary of the values in the tree.
+template <typename T, typename Monoid>
+typename Monoid::value_type
+tree_summary(const AugTreeNode<T, Monoid>* root)
+{
+    return root ? root->summary : Monoid::identity();
+}
+
+}
+
+TEST_CASE("[AugTreeNode]")
+{
+    using namespace containers;
+
+    struct test_case
+    {
+        std::string name;
+        std::vector<int> input;
+    };
+
+    std::vector<test_case> test_cases{
+        {"Empty tree.", {}},
+        {"1 node.", {1}},
+        {"2 node.", {1, 2}},
+        {"3 node.", {1, 2, 3}},
+        {"4 node.", {1, 2, 3, 4}},
+        {"7 node.", {1, 2, 3, 4, 5, 6, 7}},
+        {"8 node.", {1, 2, 3, 4, 5, 6, 7, 8}},
+        {"20 node.", std::vector<int>(20, 3)},
+    };
+
+    for (const auto& c : test_cases) {
+        INFO(c.name);
+        auto expected = make_tree(c.input);
+        auto root = make_aug_tree<int, SumSummary<int>>(c.input);
+        REQUIRE(tree_size(root.get()) == tree_size(expected.get()));
+        REQUIRE(tree_height(root.get()) == tree_height(expected.get()));
+        long sum = 0;
+        for (auto v : c.input) {
+            sum += v;
+        }
+        REQUIRE(tree_summary(root.get()) == sum);
+    }
+}
+
+TEST_CASE("[AugTreeNode] updates along the path")
+{
+    using namespace containers;
+
+    using Node = AugTreeNode<int, SumSummary<int>>;
+    auto root = std::make_shared<Node>(1);
+    auto a = root->insert_left(2);
+    auto b = a->insert_left(3);
+    REQUIRE(root->size == 3);
+    REQUIRE(root->height == 2);
+    REQUIRE(root->summary == 6);
+    REQUIRE(a->size == 2);
+    REQUIRE(a->height == 1);
+
+    // Deepen the tree below b.
+    auto c = b->insert_right(4);
+    c->insert_right(5);
+    REQUIRE(root->size == 5);
+    REQUIRE(root->height == 4);
+    REQUIRE(a->summary == 14);
+    REQUIRE(root->summary == 15);
+
+    // Replacing a subtree drops its contribution.
+    a->insert_left(10);
+    REQUIRE(root->size == 3);
+    REQUIRE(root->height == 2);
+    REQUIRE(root->summary == 13);
+
+    root->insert_right(7);
+    root->right->set_data(8);
+    REQUIRE(root->size == 4);
+    REQUIRE(root->summary == 21);
+    REQUIRE(tree_size(root->right.get()) == 1);
+    REQUIRE(tree_height(root->right.get()) == 0);
+
+    // A replaced subtree which is still held is detached, so updating it
+    // no longer touches the tree it was removed from.
+    auto held = root->right;
+    held->insert_left(3);
+    root->insert_right(1);
+    REQUIRE(held->parent == nullptr);
+    held->set_data(100);
+    REQUIRE(held->summary == 103);
+    REQUIRE(root->size == 4);
+    REQUIRE(root->summary == 14);
+
+    // So is a subtree which outlives its parent.
+    auto tree = std::make_shared<Node>(1);
+    tree->insert_left(2);
+    auto orphan = tree->left;
+    tree.reset();
+    REQUIRE(orphan->parent == nullptr);
+    orphan->set_data(5);
+    REQUIRE(orphan->summary == 5);
+
+    // Without a monoid only size and height are kept.
+    auto plain = make_aug_tree(std::vector<int>{1, 2, 3, 4});
+    REQUIRE(tree_size(plain.get()) == 4);
+    REQUIRE(tree_height(plain.get()) == 2);
+}
+
+TEST_CASE("[AugTreeNode] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    std::vector<int> values(1 << 20, 1);
+    std::shared_ptr<TreeNode<int>> plain;
+    std::shared_ptr<AugTreeNode<int>> aug;
+    MESSAGE("make_tree: " << elapsed_ms([&] { plain = make_tree(values); }) << " ms");
+    MESSAGE("make_aug_tree: " << elapsed_ms([&] { aug = make_aug_tree(values); }) << " ms");
+
+    // Query the size and height of every subtree on the left spine.
+    std::size_t v = 0;
+    MESSAGE("tree_size/tree_height on spine TreeNode: " << elapsed_ms([&] {
+        for (auto node = plain.get(); node; node = node->left.get()) {
+            v += tree_size(node) + tree_height(node);
+        }
+    }) << " ms");
+    MESSAGE("tree_size/tree_height on spine AugTreeNode: " << elapsed_ms([&] {
+        for (auto node = aug.get(); node; node = node->left.get()) {
+            v += tree_size(node) + tree_height(node);
+        }
+    }) << " ms");
+    do_not_optimize(v);
+}
@@ -0,0 +1,323 @@
+#include <cstddef>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/tree.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+struct tree_not_complete_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// ImplicitTree is a complete binary tree stored in level order in a
+// single vector. The node at index i has children at 2i+1 and 2i+2 and
+// its parent at (i-1)/2, so no pointers are stored at all.
+template <typename T>
+class ImplicitTree
+{
+public:
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+    // npos is the index returned for a child or parent which does not exist.
+    static constexpr std::size_t npos = std::size_t(-1);
+
+    ImplicitTree() = default;
+
+    // ImplicitTree takes values in the order of a level order traversal,
+    // the same order accepted by make_tree.
+    explicit ImplicitTree(std::vector<T> values) : nodes(std::move(values)) { }
+
+    // push_back adds a node in the next level order position.
+    void push_back(const T& data)
+    {
+        nodes.push_back(data);
+    }
+
+    // pop_back removes the last node in level order.
+    void pop_back()
+    {
+        nodes.pop_back();
+    }
+
+    // left returns the index of the left child of node i or npos.
+    std::size_t left(std::size_t i) const
+    {
+        auto c = 2*i + 1;
+        return c < nodes.size() ? c : npos;
+    }
+
+    // right returns the index of the right child of node i or npos.
+    std::size_t right(std::size_t i) const
+    {
+        auto c = 2*i + 2;
+        return c < nodes.size() ? c : npos;
+    }
+
+    // parent returns the index of the parent of node i or npos for the root.
+    std::size_t parent(std::size_t i) const
+    {
+        return i ? (i - 1)/2 : npos;
+    }
+
+    T& operator[](std::size_t i)
+    {
+        return nodes[i];
+    }
+
+    const T& operator[](std::size_t i) const
+    {
+        return nodes[i];
+    }
+
+    // begin and end iterate over the nodes in level order.
+    const_iterator begin() const
+    {
+        return nodes.begin();
+    }
+
+    const_iterator end() const
+    {
+        return nodes.end();
+    }
+
+    // values returns the nodes in level order.
+    const std::vector<T>& values() const
+    {
+        return nodes;
+    }
+
+    // size returns the number of nodes in the tree.
+    std::size_t size() const
+    {
+        return nodes.size();
+    }
+
+    // height returns the height of the tree, which for a complete tree
+    // of n nodes is floor(log2(n)).
+    std::size_t height() const
+    {
+        if (nodes.size() < 2) {
+            return 0;
+        }
+        return 8*sizeof(unsigned long long) - 1 - __builtin_clzll(nodes.size());
+    }
+
+private:
+    std::vector<T> nodes;
+};
+
+// make_implicit_tree returns an implicit tree with the same shape and
+// values as the complete tree at root.
+template <typename T>
+ImplicitTree<T>
+make_implicit_tree(const TreeNode<T>* root)
+{
+    // A level order traversal of a complete tree finds every node
+    // before the first missing child.
+    std::vector<T> values;
+    std::queue<const TreeNode<T>*> nodes;
+    nodes.push(root);
+    bool missing = false;
+    while (!nodes.empty()) {
+        auto node = nodes.front();
+        nodes.pop();
+        if (!node) {
+            missing = true;
+            continue;
+        }
+        if (missing) {
+            throw tree_not_complete_error{"tree is not complete"};
+        }
+        values.push_back(node->data);
+        nodes.push(node->left.get());
+        nodes.push(node->right.get());
+    }
+    return ImplicitTree<T>(std::move(values));
+}
+
+// make_tree returns a linked tree initialized from an implicit tree.
+template <typename T>
+std::shared_ptr<TreeNode<T>>
+make_tree(const ImplicitTree<T>& tree)
+{
+    return make_tree(tree.values());
+}
+
+// make_vector returns a vector initialized from a level order traversal.
+template <typename T>
+std::vector<T>
+make_vector(const ImplicitTree<T>& tree)
+{
+    return tree.values();
+}
+
+// tree_height returns the height of the tree.
+template <typename T>
+std::size_t
+tree_height(const ImplicitTree<T>& tree)
+{
+    return tree.height();
+}
+
+// tree_size returns the number of elements in the tree.
+template <typename T>
+std::size_t
+tree_size(const ImplicitTree<T>& tree)
+{
+    return tree.size();
+}
+
+}
+
+TEST_CASE("[ImplicitTree]")
+{
+    using namespace containers;
+
+    struct test_case
+    {
+        std::string name;
+        std::vector<int> input;
+        std::size_t height;
+    };
+
+    std::vector<test_case> test_cases{
+        {
+            "Empty tree.",
+            {},
+            0,
+        },
+        {
+            "1 node.",
+            {1},
+            0,
+        },
+        {
+            "2 node.",
+            {1, 2},
+            1,
+        },
+        {
+            "3 node.",
+            {1, 2, 3},
+            1,
+        },
+        {
+            "4 node.",
+            {1, 2, 3, 4},
+            2,
+        },
+        {
+            "7 node.",
+            {1, 2, 3, 4, 5, 6, 7},
+            2,
+        },
+        {
+            "8 node.",
+            {1, 2, 3, 4, 5, 6, 7, 8},
+            3,
+        }
+    };
+
+    for (const auto& c : test_cases) {
+        INFO(c.name);
+        ImplicitTree<int> tree(c.input);
+        REQUIRE(tree_size(tree) == c.input.size());
+        REQUIRE(tree_height(tree) == c.height);
+        REQUIRE(make_vector(tree) == c.input);
+
+        // Agrees with the linked tree built from the same values.
+        auto root = make_tree(tree);
+        REQUIRE(make_vector(root.get()) == c.input);
+        REQUIRE(tree_height(root.get()) == c.height);
+        REQUIRE(make_implicit_tree(root.get()).values() == c.input);
+    }
+}
+
+TEST_CASE("[ImplicitTree] navigation")
+{
+    using namespace containers;
+
+    //       1
+    //     2   3
+    //    4 5 6
+    ImplicitTree<int> tree({1, 2, 3, 4, 5, 6});
+    using Tree = ImplicitTree<int>;
+    REQUIRE(tree[tree.left(0)] == 2);
+    REQUIRE(tree[tree.right(0)] == 3);
+    REQUIRE(tree[tree.left(1)] == 4);
+    REQUIRE(tree[tree.right(1)] == 5);
+    REQUIRE(tree[tree.left(2)] == 6);
+    REQUIRE(tree.right(2) == Tree::npos);
+    REQUIRE(tree.left(3) == Tree::npos);
+    REQUIRE(tree.parent(0) == Tree::npos);
+    REQUIRE(tree[tree.parent(5)] == 3);
+    REQUIRE(tree[tree.parent(4)] == 2);
+
+    tree.push_back(7);
+    REQUIRE(tree[tree.right(2)] == 7);
+    REQUIRE(tree.height() == 2);
+    tree.push_back(8);
+    REQUIRE(tree.height() == 3);
+    tree.pop_back();
+    REQUIRE(tree.height() == 2);
+}
+
+TEST_CASE("[make_implicit_tree] incomplete tree")
+{
+    using namespace containers;
+
+    auto root = make_tree(std::vector<int>{1, 2, 3});
+    root->left->insert_right(5); // Missing left child of 2.
+    REQUIRE_THROWS_AS(make_implicit_tree(root.get()), tree_not_complete_error);
+
+    root = make_tree(std::vector<int>{1, 2, 3, 4});
+    root->right->insert_left(6); // Missing right child of 2.
+    REQUIRE_THROWS_AS(make_implicit_tree(root.get()), tree_not_complete_error);
+
+    REQUIRE(make_implicit_tree<int>(nullptr).size() == 0);
+}
+
+TEST_CASE("[ImplicitTree] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 4000000;
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = i;
+    }
+
+    std::shared_ptr<TreeNode<int>> root;
+    MESSAGE("make_tree: " << elapsed_ms([&] { root = make_tree(values); }) << " ms");
+    ImplicitTree<int> tree;
+    MESSAGE("ImplicitTree: " << elapsed_ms([&] { tree = ImplicitTree<int>(values); }) << " ms");
+
+    std::size_t size = 0;
+    MESSAGE("tree_size TreeNode: " << elapsed_ms([&] { size = tree_size(root.get()); }) << " ms");
+    MESSAGE("tree_size ImplicitTree: " << elapsed_ms([&] { size = tree_size(tree); }) << " ms");
+    do_not_optimize(size);
+
+    std::vector<int> level;
+    MESSAGE("make_vector TreeNode: " << elapsed_ms([&] { level = make_vector(root.get()); }) << " ms");
+    MESSAGE("make_vector ImplicitTree: " << elapsed_ms([&] { level = make_vector(tree); }) << " ms");
+
+    // Each linked node is a TreeNode plus the shared_ptr control block
+    // allocated with it by make_shared.
+    auto linked = sizeof(TreeNode<int>) + 2*sizeof(long);
+    MESSAGE("bytes/node TreeNode: ~" << linked << " ImplicitTree: " << sizeof(int));
+}
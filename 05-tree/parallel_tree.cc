@@ -0,0 +1,438 @@
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/tree.h"
+#include "containers/work_stealing.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// tree_fold returns combine(root, fold(left), fold(right)) computed
+// bottom up over the whole tree, where an empty subtree folds to empty.
+// Uses an explicit stack so any tree shape is safe.
+template <typename T, typename R, typename Combine>
+R
+tree_fold(const TreeNode<T>* root, const R& empty, Combine combine)
+{
+    if (!root) {
+        return empty;
+    }
+
+    // Nodes are expanded on the way down and combined on the way up,
+    // when the results of their subtrees are on top of results.
+    std::vector<std::pair<const TreeNode<T>*, bool>> stack{{root, false}};
+    std::vector<R> results;
+    auto pop = [&results]() {
+        auto r = std::move(results.back());
+        results.pop_back();
+        return r;
+    };
+    while (!stack.empty()) {
+        auto [node, expanded] = stack.back();
+        if (!expanded) {
+            stack.back().second = true;
+            if (node->right) {
+                stack.emplace_back(node->right.get(), false);
+            }
+            if (node->left) {
+                stack.emplace_back(node->left.get(), false);
+            }
+            continue;
+        }
+        stack.pop_back();
+        R right = node->right ? pop() : empty;
+        R left = node->left ? pop() : empty;
+        results.push_back(combine(node, std::move(left), std::move(right)));
+    }
+    return results.back();
+}
+
+// tree_fold is the parallel version of tree_fold. Subtrees rooted above
+// cutoff depth are folded as parallel tasks on pool; below it each
+// subtree is folded sequentially.
+template <typename T, typename R, typename Combine>
+R
+tree_fold(TaskPool& pool, const TreeNode<T>* root, const R& empty, Combine combine,
+          std::size_t cutoff)
+{
+    if (!root) {
+        return empty;
+    }
+    if (!cutoff) {
+        return tree_fold(root, empty, combine);
+    }
+    R left = empty;
+    R right = empty;
+    pool.invoke(
+        [&] { left = tree_fold(pool, root->left.get(), empty, combine, cutoff-1); },
+        [&] { right = tree_fold(pool, root->right.get(), empty, combine, cutoff-1); });
+    return combine(root, std::move(left), std::move(right));
+}
+
+// default_cutoff returns a cutoff depth giving each thread of pool
+// several subtrees to balance the load.
+inline std::size_t
+default_cutoff(const TaskPool& pool)
+{
+    std::size_t depth = 0;
+    while ((std::size_t(1) << depth) < pool.size()) {
+        ++depth;
+    }
+    return depth + 4;
+}
+
+// parallel_tree_reduce returns reduce applied over map of the data of
+// every node, or identity for an empty tree. reduce must be associative.
+template <typename T, typename R, typename Map, typename Reduce>
+R
+parallel_tree_reduce(TaskPool& pool, const TreeNode<T>* root, const R& identity,
+                     Map map, Reduce reduce, std::size_t cutoff)
+{
+    return tree_fold(pool, root, identity,
+        [&map, &reduce](const TreeNode<T>* node, R left, R right) {
+            return reduce(reduce(std::move(left), map(node->data)), std::move(right));
+        },
+        cutoff);
+}
+
+template <typename T, typename R, typename Map, typename Reduce>
+R
+parallel_tree_reduce(TaskPool& pool, const TreeNode<T>* root, const R& identity,
+                     Map map, Reduce reduce)
+{
+    return parallel_tree_reduce(pool, root, identity, map, reduce, default_cutoff(pool));
+}
+
+// parallel_tree_size returns the number of elements in the tree.
+template <typename T>
+std::size_t
+parallel_tree_size(TaskPool& pool, const TreeNode<T>* root, std::size_t cutoff)
+{
+    return tree_fold(pool, root, std::size_t(0),
+        [](const TreeNode<T>*, std::size_t left, std::size_t right) {
+            return 1 + left + right;
+        },
+        cutoff);
+}
+
+template <typename T>
+std::size_t
+parallel_tree_size(TaskPool& pool, const TreeNode<T>* root)
+{
+    return parallel_tree_size(pool, root, default_cutoff(pool));
+}
+
+// parallel_tree_height returns the height of the tree.
+template <typename T>
+std::size_t
+parallel_tree_height(TaskPool& pool, const TreeNode<T>* root, std::size_t cutoff)
+{
+    // Fold the number of levels, which is 0 for an empty tree.
+    auto levels = tree_fold(pool, root, std::size_t(0),
+        [](const TreeNode<T>*, std::size_t left, std::size_t right) {
+            return 1 + std::max(left, right);
+        },
+        cutoff);
+    return levels ? levels - 1 : 0;
+}
+
+template <typename T>
+std::size_t
+parallel_tree_height(TaskPool& pool, const TreeNode<T>* root)
+{
+    return parallel_tree_height(pool, root, default_cutoff(pool));
+}
+
+// for_each_chunk calls f(c) for each c in [0, nchunks) as parallel tasks.
+template <typename F>
+void
+for_each_chunk(TaskPool& pool, std::size_t nchunks, F f)
+{
+    if (nchunks == 1) {
+        f(0);
+        return;
+    }
+    TaskGroup group(pool);
+    for (std::size_t c = 1; c < nchunks; ++c) {
+        group.spawn([&f, c] { f(c); });
+    }
+    f(0);
+    group.wait();
+}
+
+// parallel_level_order returns visit(node) for every node of the tree in
+// level order. Each level of the tree is split into chunks of grain nodes
+// which are visited as parallel tasks; every chunk collects its results
+// and the children of its nodes in its own buffers, so no two tasks write
+// to the same vector, even a vector<bool>. The buffers are joined in
+// chunk order to extend the results and form the next level. Throws
+// std::invalid_argument if grain is 0.
+template <typename T, typename Visit>
+auto
+parallel_level_order(TaskPool& pool, const TreeNode<T>* root, Visit visit,
+                     std::size_t grain = 4096)
+    -> std::vector<std::decay_t<decltype(visit(root))>>
+{
+    using R = std::decay_t<decltype(visit(root))>;
+    using Level = std::vector<const TreeNode<T>*>;
+
+    if (!grain) {
+        throw std::invalid_argument{"parallel_level_order: grain must be positive"};
+    }
+
+    std::vector<R> results;
+    Level level;
+    Level next;
+    std::vector<std::vector<R>> visited; // Results of each chunk.
+    std::vector<Level> children;         // Children found by each chunk.
+    std::vector<std::size_t> offsets;
+    if (root) {
+        level.push_back(root);
+    }
+    while (!level.empty()) {
+        auto nchunks = (level.size() + grain - 1)/grain;
+        visited.resize(std::max(visited.size(), nchunks));
+        children.resize(std::max(children.size(), nchunks));
+        for_each_chunk(pool, nchunks, [&](std::size_t c) {
+            auto lo = c*grain;
+            auto hi = std::min(lo + grain, level.size());
+            auto& values = visited[c];
+            auto& found = children[c];
+            values.clear();
+            found.clear();
+            for (auto i = lo; i < hi; ++i) {
+                auto node = level[i];
+                values.push_back(visit(node));
+                if (node->left) {
+                    found.push_back(node->left.get());
+                }
+                if (node->right) {
+                    found.push_back(node->right.get());
+                }
+            }
+        });
+
+        for (std::size_t c = 0; c < nchunks; ++c) {
+            std::move(visited[c].begin(), visited[c].end(), std::back_inserter(results));
+        }
+        offsets.assign(nchunks + 1, 0);
+        for (std::size_t c = 0; c < nchunks; ++c) {
+            offsets[c + 1] = offsets[c] + children[c].size();
+        }
+        next.resize(offsets[nchunks]);
+        for_each_chunk(pool, nchunks, [&](std::size_t c) {
+            std::copy(children[c].begin(), children[c].end(), next.begin() + offsets[c]);
+        });
+        level.swap(next);
+    }
+    return results;
+}
+
+// parallel_make_vector returns the values of the tree in level order,
+// the same vector returned by make_vector.
+template <typename T>
+std::vector<T>
+parallel_make_vector(TaskPool& pool, const TreeNode<T>* root, std::size_t grain = 4096)
+{
+    return parallel_level_order(pool, root,
+                                [](const TreeNode<T>* node) { return node->data; },
+                                grain);
+}
+
+}
+
+TEST_CASE("[parallel_tree_size] [parallel_tree_height]")
+{
+    using namespace containers;
+
+    std::vector<std::shared_ptr<TreeNode<int>>> trees;
+    for (int n : {0, 1, 2, 3, 7, 8, 100, 1000}) {
+        trees.push_back(make_tree(std::vector<int>(n)));
+    }
+    // Unbalanced: a long left spine with a complete right subtree.
+    auto root = make_tree(std::vector<int>(31));
+    auto node = root.get();
+    while (node->left) {
+        node = node->left.get();
+    }
+    for (int i = 0; i < 50; ++i) {
+        node = node->insert_left(i);
+    }
+    trees.push_back(root);
+
+    for (std::size_t nthreads : {1, 3}) {
+        TaskPool pool(nthreads);
+        for (const auto& t : trees) {
+            for (std::size_t cutoff : {0, 1, 3, 64}) {
+                REQUIRE(parallel_tree_size(pool, t.get(), cutoff) == tree_size(t.get()));
+                REQUIRE(parallel_tree_height(pool, t.get(), cutoff) == tree_height(t.get()));
+            }
+            REQUIRE(parallel_tree_size(pool, t.get()) == tree_size(t.get()));
+            REQUIRE(parallel_tree_height(pool, t.get()) == tree_height(t.get()));
+        }
+    }
+}
+
+TEST_CASE("[parallel_tree_reduce]")
+{
+    using namespace containers;
+
+    std::vector<int> values(1000);
+    for (int i = 0; i < 1000; ++i) {
+        values[i] = i + 1;
+    }
+    auto root = make_tree(values);
+    TaskPool pool(4);
+
+    auto identity = [](int v) { return long(v); };
+    auto sum = [](long a, long b) { return a + b; };
+    REQUIRE(parallel_tree_reduce(pool, root.get(), 0L, identity, sum) == 500500);
+
+    auto max = [](int a, int b) { return std::max(a, b); };
+    auto same = [](int v) { return v; };
+    REQUIRE(parallel_tree_reduce(pool, root.get(), 0, same, max) == 1000);
+
+    // Associative but not commutative: values are combined in order.
+    auto str = [](int v) { return std::to_string(v % 10); };
+    auto concat = [](std::string a, std::string b) { return a + b; };
+    auto small = make_tree(std::vector<int>{1, 2, 3, 4, 5, 6, 7});
+    // Inorder: 4 2 5 1 6 3 7.
+    REQUIRE(parallel_tree_reduce(pool, small.get(), std::string(), str, concat, 2)
+            == "4251637");
+
+    REQUIRE(parallel_tree_reduce(pool, static_cast<TreeNode<int>*>(nullptr), 0L,
+                                 identity, sum) == 0);
+}
+
+TEST_CASE("[parallel_tree_size] deep tree")
+{
+    using namespace containers;
+
+    // The sequential fold below the cutoff must not recurse per level.
+    auto root = std::make_shared<TreeNode<int>>(0);
+    auto node = root.get();
+    for (int i = 1; i < 1000000; ++i) {
+        node = node->insert_left(i);
+    }
+    TaskPool pool(2);
+    REQUIRE(parallel_tree_size(pool, root.get()) == 1000000);
+    REQUIRE(parallel_tree_height(pool, root.get()) == 999999);
+}
+
+TEST_CASE("[parallel_tree_reduce] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const std::size_t n = std::size_t(1) << 23;
+    auto root = make_tree(std::vector<int>(n, 1));
+
+    std::size_t size = 0;
+    MESSAGE("tree_size: " << elapsed_ms([&] { size = tree_size(root.get()); }) << " ms");
+    REQUIRE(size == n);
+
+    auto one = [](int v) { return long(v); };
+    auto sum = [](long a, long b) { return a + b; };
+    auto nmax = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned nthreads = 1; nthreads <= nmax; nthreads *= 2) {
+        TaskPool pool(nthreads);
+        std::size_t height = 0;
+        long total = 0;
+        auto size_ms = elapsed_ms([&] { size = parallel_tree_size(pool, root.get()); });
+        auto height_ms = elapsed_ms([&] { height = parallel_tree_height(pool, root.get()); });
+        auto sum_ms = elapsed_ms([&] {
+            total = parallel_tree_reduce(pool, root.get(), 0L, one, sum);
+        });
+        REQUIRE(size == n);
+        REQUIRE(height == 23);
+        REQUIRE(total == long(n));
+        MESSAGE(nthreads << " threads: size " << size_ms << " ms, height "
+                << height_ms << " ms, sum " << sum_ms << " ms");
+    }
+}
+
+TEST_CASE("[parallel_level_order]")
+{
+    using namespace containers;
+
+    std::vector<std::shared_ptr<TreeNode<int>>> trees;
+    for (int n : {0, 1, 2, 5, 64, 1000}) {
+        std::vector<int> values(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = i;
+        }
+        trees.push_back(make_tree(values));
+    }
+    auto root = std::make_shared<TreeNode<int>>(0);
+    auto node = root.get();
+    for (int i = 1; i < 100; ++i) {
+        node = i % 2 ? node->insert_right(i) : node->insert_left(i);
+        node->insert_left(-i);
+    }
+    trees.push_back(root);
+
+    for (std::size_t nthreads : {1, 4}) {
+        TaskPool pool(nthreads);
+        for (const auto& t : trees) {
+            for (std::size_t grain : {1, 3, 4096}) {
+                REQUIRE(parallel_make_vector(pool, t.get(), grain) == make_vector(t.get()));
+            }
+            auto twice = parallel_level_order(pool, t.get(),
+                [](const TreeNode<int>* n) { return 2L*n->data; }, 7);
+            auto expected = make_vector(t.get());
+            REQUIRE(twice.size() == expected.size());
+            for (std::size_t i = 0; i < expected.size(); ++i) {
+                REQUIRE(twice[i] == 2L*expected[i]);
+            }
+            // Chunks of a vector<bool> share words, so each chunk must
+            // write to its own buffer.
+            auto odd = parallel_level_order(pool, t.get(),
+                [](const TreeNode<int>* n) { return n->data % 2 != 0; }, 1);
+            REQUIRE(odd.size() == expected.size());
+            for (std::size_t i = 0; i < expected.size(); ++i) {
+                REQUIRE(odd[i] == (expected[i] % 2 != 0));
+            }
+        }
+        REQUIRE_THROWS_AS(parallel_make_vector(pool, trees.back().get(), 0),
+                          std::invalid_argument);
+    }
+}
+
+TEST_CASE("[parallel_level_order] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const std::size_t n = std::size_t(1) << 23;
+    std::vector<int> values(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        values[i] = int(i);
+    }
+    auto root = make_tree(values);
+
+    std::vector<int> v;
+    MESSAGE("make_vector: " << elapsed_ms([&] { v = make_vector(root.get()); }) << " ms");
+    REQUIRE(v == values);
+
+    auto nmax = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned nthreads = 1; nthreads <= nmax; nthreads *= 2) {
+        TaskPool pool(nthreads);
+        auto ms = elapsed_ms([&] { v = parallel_make_vector(pool, root.get()); });
+        REQUIRE(v == values);
+        MESSAGE("parallel_make_vector " << nthreads << " threads: " << ms << " ms");
+    }
+}
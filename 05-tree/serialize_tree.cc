@@ -0,0 +1,590 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/tree.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+struct tree_format_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// BufferSink appends written bytes to a vector.
+class BufferSink
+{
+public:
+    explicit BufferSink(std::vector<char>& buf) : buf(buf) { }
+
+    void write(const char* data, std::size_t n)
+    {
+        buf.insert(buf.end(), data, data + n);
+    }
+
+private:
+    std::vector<char>& buf;
+};
+
+// FdSink writes bytes to a file descriptor.
+class FdSink
+{
+public:
+    explicit FdSink(int fd) : fd(fd) { }
+
+    void write(const char* data, std::size_t n)
+    {
+        while (n) {
+            auto w = ::write(fd, data, n);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w < 0) {
+                throw std::system_error{errno, std::generic_category(), "write"};
+            }
+            data += w;
+            n -= w;
+        }
+    }
+
+private:
+    int fd;
+};
+
+// BufferSource reads bytes from memory.
+class BufferSource
+{
+public:
+    BufferSource(const char* data, std::size_t n) : data(data), n(n) { }
+
+    // read copies up to len bytes into buf and returns the count, 0 at end.
+    std::size_t read(char* buf, std::size_t len)
+    {
+        auto c = std::min(len, n);
+        std::memcpy(buf, data, c);
+        data += c;
+        n -= c;
+        return c;
+    }
+
+private:
+    const char* data;
+    std::size_t n;
+};
+
+// FdSource reads bytes from a file descriptor.
+class FdSource
+{
+public:
+    explicit FdSource(int fd) : fd(fd) { }
+
+    std::size_t read(char* buf, std::size_t len)
+    {
+        for (;;) {
+            auto r = ::read(fd, buf, len);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r < 0) {
+                throw std::system_error{errno, std::generic_category(), "read"};
+            }
+            return std::size_t(r);
+        }
+    }
+
+private:
+    int fd;
+};
+
+// The serialized form of a tree is a header followed by its nodes in
+// preorder. Each node is a tag byte recording which children follow
+// and the raw bytes of its data, in host byte order.
+//
+//   header: "TREE" | uint32 sizeof(T) | uint8 1 if tree is not empty
+//   node:   uint8 (1 if left child) | (2 if right child) | T data
+namespace tree_format
+{
+constexpr char magic[4] = {'T', 'R', 'E', 'E'};
+constexpr std::uint8_t has_left = 1;
+constexpr std::uint8_t has_right = 2;
+constexpr std::size_t buffer_size = 1 << 16;
+}
+
+// TreeWriter serializes trees to Sink through a fixed size buffer.
+template <typename T, typename Sink>
+class TreeWriter
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "TreeWriter writes the bytes of each value");
+
+public:
+    explicit TreeWriter(Sink& sink) : sink(sink) { }
+
+    TreeWriter(const TreeWriter&) = delete;
+    TreeWriter& operator=(const TreeWriter&) = delete;
+
+    ~TreeWriter()
+    {
+        try {
+            flush();
+        }
+        catch (...) {
+            // Errors are only reported by an explicit flush.
+        }
+    }
+
+    // write appends the tree at root to the stream.
+    void write(const TreeNode<T>* root)
+    {
+        put(tree_format::magic, sizeof(tree_format::magic));
+        std::uint32_t size = sizeof(T);
+        put(reinterpret_cast<const char*>(&size), sizeof(size));
+        std::uint8_t present = root ? 1 : 0;
+        put(reinterpret_cast<const char*>(&present), 1);
+
+        stack.clear();
+        if (root) {
+            stack.push_back(root);
+        }
+        while (!stack.empty()) {
+            auto node = stack.back();
+            stack.pop_back();
+            std::uint8_t tag = (node->left ? tree_format::has_left : 0)
+                             | (node->right ? tree_format::has_right : 0);
+            put(reinterpret_cast<const char*>(&tag), 1);
+            put(reinterpret_cast<const char*>(&node->data), sizeof(T));
+            if (node->right) {
+                stack.push_back(node->right.get());
+            }
+            if (node->left) {
+                stack.push_back(node->left.get());
+            }
+        }
+    }
+
+    // flush writes buffered bytes to the sink.
+    void flush()
+    {
+        sink.write(buf.data(), used);
+        used = 0;
+    }
+
+private:
+    Sink& sink;
+    std::vector<char> buf = std::vector<char>(tree_format::buffer_size);
+    std::size_t used = 0;
+    std::vector<const TreeNode<T>*> stack;
+
+    // put buffers n bytes of data, or writes them straight to the sink
+    // after the buffered bytes if they do not fit in the buffer.
+    void put(const char* data, std::size_t n)
+    {
+        if (used + n > buf.size()) {
+            flush();
+            if (n > buf.size()) {
+                sink.write(data, n);
+                return;
+            }
+        }
+        std::memcpy(buf.data() + used, data, n);
+        used += n;
+    }
+};
+
+// TreeReader deserializes trees from Source through a fixed size buffer.
+template <typename T, typename Source>
+class TreeReader
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "TreeReader reads the bytes of each value");
+
+public:
+    explicit TreeReader(Source& source) : source(source) { }
+
+    TreeReader(const TreeReader&) = delete;
+    TreeReader& operator=(const TreeReader&) = delete;
+
+    // read returns the next tree in the stream.
+    std::shared_ptr<TreeNode<T>> read()
+    {
+        std::shared_ptr<TreeNode<T>> root;
+
+        // Preorder means the next node is the left child of the last
+        // node if it has one, or else the right child still owed to the
+        // most recent node.
+        TreeNode<T>* pending_left = nullptr;
+        std::vector<TreeNode<T>*> pending_right;
+        auto place = [&](TreeNode<T>* node, std::uint8_t tag) {
+            if (tag & tree_format::has_right) {
+                pending_right.push_back(node);
+            }
+            pending_left = (tag & tree_format::has_left) ? node : nullptr;
+        };
+
+        if (!header()) {
+            return root;
+        }
+        std::uint8_t tag = 0;
+        T data;
+        get_node(tag, data);
+        root = std::make_shared<TreeNode<T>>(data);
+        place(root.get(), tag);
+        while (pending_left || !pending_right.empty()) {
+            get_node(tag, data);
+            TreeNode<T>* node = nullptr;
+            if (pending_left) {
+                node = pending_left->insert_left(data);
+            }
+            else {
+                node = pending_right.back()->insert_right(data);
+                pending_right.pop_back();
+            }
+            place(node, tag);
+        }
+        return root;
+    }
+
+    // visit calls visit(data, depth) for each node of the next tree in
+    // the stream in preorder without building the tree, and returns
+    // the number of nodes.
+    template <typename Visit>
+    std::size_t visit(Visit&& visit)
+    {
+        if (!header()) {
+            return 0;
+        }
+        // Depths of the nodes whose right child is still to come.
+        std::vector<std::size_t> pending_right;
+        std::size_t count = 0;
+        std::size_t depth = 0;
+        for (;;) {
+            std::uint8_t tag = 0;
+            T data;
+            get_node(tag, data);
+            visit(static_cast<const T&>(data), depth);
+            ++count;
+            if (tag & tree_format::has_right) {
+                pending_right.push_back(depth + 1);
+            }
+            if (tag & tree_format::has_left) {
+                ++depth;
+            }
+            else if (!pending_right.empty()) {
+                depth = pending_right.back();
+                pending_right.pop_back();
+            }
+            else {
+                return count;
+            }
+        }
+    }
+
+private:
+    Source& source;
+    std::vector<char> buf = std::vector<char>(tree_format::buffer_size);
+    std::size_t pos = 0;
+    std::size_t end = 0;
+
+    // header reads a tree header and returns whether the tree has nodes.
+    bool header()
+    {
+        char magic[sizeof(tree_format::magic)];
+        get(magic, sizeof(magic));
+        if (std::memcmp(magic, tree_format::magic, sizeof(magic)) != 0) {
+            throw tree_format_error{"bad tree header"};
+        }
+        std::uint32_t size = 0;
+        get(reinterpret_cast<char*>(&size), sizeof(size));
+        if (size != sizeof(T)) {
+            throw tree_format_error{"tree data size mismatch"};
+        }
+        std::uint8_t present = 0;
+        get(reinterpret_cast<char*>(&present), 1);
+        return present;
+    }
+
+    void get_node(std::uint8_t& tag, T& data)
+    {
+        get(reinterpret_cast<char*>(&tag), 1);
+        get(reinterpret_cast<char*>(&data), sizeof(T));
+    }
+
+    // get copies exactly n bytes from the stream into data.
+    void get(char* data, std::size_t n)
+    {
+        while (n) {
+            if (pos == end) {
+                pos = 0;
+                end = source.read(buf.data(), buf.size());
+                if (!end) {
+                    throw tree_format_error{"truncated tree"};
+                }
+            }
+            auto c = std::min(n, end - pos);
+            std::memcpy(data, buf.data() + pos, c);
+            pos += c;
+            data += c;
+            n -= c;
+        }
+    }
+};
+
+}
+
+namespace
+{
+
+// preorder returns the values of the tree in preorder.
+template <typename T>
+std::vector<T> preorder(const containers::TreeNode<T>* root)
+{
+    std::vector<T> values;
+    std::vector<const containers::TreeNode<T>*> stack;
+    if (root) {
+        stack.push_back(root);
+    }
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+        values.push_back(node->data);
+        if (node->right) {
+            stack.push_back(node->right.get());
+        }
+        if (node->left) {
+            stack.push_back(node->left.get());
+        }
+    }
+    return values;
+}
+
+// make_trees returns trees of assorted shapes.
+std::vector<std::shared_ptr<containers::TreeNode<int>>> make_trees()
+{
+    using namespace containers;
+
+    std::vector<std::shared_ptr<TreeNode<int>>> trees;
+    for (int n : {0, 1, 2, 3, 7, 100}) {
+        std::vector<int> values(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = i;
+        }
+        trees.push_back(make_tree(values));
+    }
+    auto root = std::make_shared<TreeNode<int>>(0);
+    auto node = root.get();
+    for (int i = 1; i < 200; ++i) {
+        node = i % 4 ? node->insert_right(i) : node->insert_left(i);
+        if (i % 7 == 0) {
+            node->insert_left(-i)->insert_right(-2*i);
+        }
+    }
+    trees.push_back(root);
+    return trees;
+}
+
+}
+
+TEST_CASE("[TreeWriter] [TreeReader] buffer")
+{
+    using namespace containers;
+
+    auto trees = make_trees();
+    std::vector<char> buf;
+    {
+        BufferSink sink(buf);
+        TreeWriter<int, BufferSink> writer(sink);
+        for (const auto& t : trees) {
+            writer.write(t.get());
+        }
+    }
+
+    // Trees are read back in the order written.
+    BufferSource source(buf.data(), buf.size());
+    TreeReader<int, BufferSource> reader(source);
+    for (const auto& t : trees) {
+        auto root = reader.read();
+        REQUIRE(make_vector(root.get()) == make_vector(t.get()));
+        REQUIRE(preorder(root.get()) == preorder(t.get()));
+    }
+    REQUIRE_THROWS_AS(reader.read(), tree_format_error);
+
+    // Truncated streams and mismatched data are rejected.
+    BufferSource truncated(buf.data(), buf.size() - 1);
+    TreeReader<int, BufferSource> treader(truncated);
+    for (std::size_t i = 0; i + 1 < trees.size(); ++i) {
+        treader.read();
+    }
+    REQUIRE_THROWS_AS(treader.read(), tree_format_error);
+
+    BufferSource wrong(buf.data(), buf.size());
+    TreeReader<long, BufferSource> wreader(wrong);
+    REQUIRE_THROWS_AS(wreader.read(), tree_format_error);
+}
+
+TEST_CASE("[TreeWriter] [TreeReader] data larger than the buffer")
+{
+    using namespace containers;
+
+    struct Large
+    {
+        int id;
+        char bytes[tree_format::buffer_size + 1000];
+    };
+    auto make_large = [](int id) {
+        Large v;
+        v.id = id;
+        for (std::size_t i = 0; i < sizeof(v.bytes); ++i) {
+            v.bytes[i] = char(id + i);
+        }
+        return v;
+    };
+
+    auto root = std::make_shared<TreeNode<Large>>(make_large(1));
+    root->insert_left(make_large(2))->insert_right(make_large(4));
+    root->insert_right(make_large(3));
+
+    std::vector<char> buf;
+    {
+        BufferSink sink(buf);
+        TreeWriter<Large, BufferSink> writer(sink);
+        writer.write(root.get());
+        writer.write(root->left.get());
+    }
+
+    BufferSource source(buf.data(), buf.size());
+    TreeReader<Large, BufferSource> reader(source);
+    for (auto t : {root.get(), root->left.get()}) {
+        auto copy = reader.read();
+        auto expected = preorder(t);
+        auto values = preorder(copy.get());
+        REQUIRE(values.size() == expected.size());
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            REQUIRE(values[i].id == expected[i].id);
+            REQUIRE(std::memcmp(values[i].bytes, expected[i].bytes, sizeof(values[i].bytes)) == 0);
+        }
+    }
+    REQUIRE_THROWS_AS(reader.read(), tree_format_error);
+}
+
+TEST_CASE("[TreeReader] visit")
+{
+    using namespace containers;
+
+    auto trees = make_trees();
+    std::vector<char> buf;
+    BufferSink sink(buf);
+    TreeWriter<int, BufferSink> writer(sink);
+    for (const auto& t : trees) {
+        writer.write(t.get());
+    }
+    writer.flush();
+
+    BufferSource source(buf.data(), buf.size());
+    TreeReader<int, BufferSource> reader(source);
+    for (const auto& t : trees) {
+        std::vector<int> values;
+        std::size_t height = 0;
+        auto count = reader.visit([&](int v, std::size_t depth) {
+            values.push_back(v);
+            height = std::max(height, depth);
+        });
+        REQUIRE(count == tree_size(t.get()));
+        REQUIRE(values == preorder(t.get()));
+        REQUIRE(height == tree_height(t.get()));
+    }
+}
+
+TEST_CASE("[TreeWriter] [TreeReader] file descriptor")
+{
+    using namespace containers;
+
+    // payload is a trivially copyable record.
+    struct payload
+    {
+        int id;
+        double weight;
+    };
+
+    auto root = std::make_shared<TreeNode<payload>>(payload{0, 0.0});
+    auto node = root.get();
+    for (int i = 1; i < 20000; ++i) {
+        node = node->insert_left(payload{i, i*0.5});
+    }
+
+    std::FILE* f = std::tmpfile();
+    REQUIRE(f != nullptr);
+    int fd = fileno(f);
+    {
+        FdSink sink(fd);
+        TreeWriter<payload, FdSink> writer(sink);
+        writer.write(root.get());
+        writer.write(nullptr);
+        writer.flush();
+    }
+    REQUIRE(::lseek(fd, 0, SEEK_SET) == 0);
+
+    FdSource source(fd);
+    TreeReader<payload, FdSource> reader(source);
+    auto rt = reader.read();
+    REQUIRE(tree_size(rt.get()) == 20000);
+    REQUIRE(tree_height(rt.get()) == 19999);
+    std::size_t i = 0;
+    bool same = true;
+    for (auto n = rt.get(); n; n = n->left.get(), ++i) {
+        same = same && n->data.id == int(i) && n->data.weight == i*0.5;
+    }
+    REQUIRE(same);
+    REQUIRE(reader.read() == nullptr);
+    std::fclose(f);
+}
+
+TEST_CASE("[TreeWriter] [TreeReader] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    std::vector<int> values(1 << 21);
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        values[i] = int(i);
+    }
+    auto root = make_tree(values);
+
+    std::shared_ptr<TreeNode<int>> copy;
+    MESSAGE("make_vector + make_tree: " << elapsed_ms([&] {
+        auto v = make_vector(root.get());
+        copy = make_tree(v);
+    }) << " ms");
+
+    std::vector<char> buf;
+    buf.reserve(values.size()*(1 + sizeof(int)) + 64);
+    MESSAGE("TreeWriter: " << elapsed_ms([&] {
+        BufferSink sink(buf);
+        TreeWriter<int, BufferSink> writer(sink);
+        writer.write(root.get());
+    }) << " ms, " << double(buf.size())/values.size() << " bytes/node");
+    MESSAGE("TreeReader: " << elapsed_ms([&] {
+        BufferSource source(buf.data(), buf.size());
+        TreeReader<int, BufferSource> reader(source);
+        copy = reader.read();
+    }) << " ms");
+    REQUIRE(tree_size(copy.get()) == values.size());
+}
@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/tree.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// BitVector is an append only vector of bits supporting rank and select.
+// Ranks are sampled every 512 bits, so rank costs a lookup and at most
+// 8 popcounts, and select is a binary search over the samples.
+class BitVector
+{
+public:
+    // push_back appends bit b.
+    void push_back(bool b)
+    {
+        if (nbits % 64 == 0) {
+            words.push_back(0);
+        }
+        if (b) {
+            words.back() |= std::uint64_t(1) << (nbits % 64);
+        }
+        ++nbits;
+    }
+
+    // build computes the rank samples; call once after the last push_back.
+    void build()
+    {
+        samples.assign(words.size()/words_per_sample + 1, 0);
+        std::size_t ones = 0;
+        for (std::size_t w = 0; w < words.size(); ++w) {
+            if (w % words_per_sample == 0) {
+                samples[w/words_per_sample] = ones;
+            }
+            ones += popcount(words[w]);
+        }
+        if (words.size() % words_per_sample == 0) {
+            samples.back() = ones;
+        }
+    }
+
+    bool operator[](std::size_t i) const
+    {
+        return (words[i/64] >> (i % 64)) & 1;
+    }
+
+    // rank1 returns the number of ones in positions [0, i).
+    std::size_t rank1(std::size_t i) const
+    {
+        auto w = i/64;
+        std::size_t ones = samples[w/words_per_sample];
+        for (auto j = w/words_per_sample*words_per_sample; j < w; ++j) {
+            ones += popcount(words[j]);
+        }
+        if (i % 64) {
+            ones += popcount(words[w] & ((std::uint64_t(1) << (i % 64)) - 1));
+        }
+        return ones;
+    }
+
+    // select1 returns the position of the kth one, counting from 1.
+    std::size_t select1(std::size_t k) const
+    {
+        // Find the last sample with fewer than k ones before it.
+        auto s = std::lower_bound(std::begin(samples), std::end(samples), k) - std::begin(samples) - 1;
+        std::size_t ones = samples[s];
+        auto w = s*words_per_sample;
+        for (;; ++w) {
+            auto c = popcount(words[w]);
+            if (ones + c >= k) {
+                break;
+            }
+            ones += c;
+        }
+        auto word = words[w];
+        for (; ones + 1 < k; ++ones) {
+            word &= word - 1; // Clear lowest set bit.
+        }
+        return w*64 + __builtin_ctzll(word);
+    }
+
+    // size returns the number of bits.
+    std::size_t size() const
+    {
+        return nbits;
+    }
+
+    // bytes returns the memory used by the bits and rank samples.
+    std::size_t bytes() const
+    {
+        return words.size()*sizeof(std::uint64_t) + samples.size()*sizeof(std::size_t);
+    }
+
+private:
+    static constexpr std::size_t words_per_sample = 8;
+
+    std::vector<std::uint64_t> words;
+    std::vector<std::size_t> samples;
+    std::size_t nbits = 0;
+
+    static std::size_t popcount(std::uint64_t w)
+    {
+        return __builtin_popcountll(w);
+    }
+};
+
+// SuccinctTree is a static binary tree whose shape takes 2 bits per node.
+// Nodes are numbered in level order and the payload is stored in that
+// order. Bits 2i and 2i+1 of the shape record whether node i has a left
+// and right child; the node numbered j > 0 is the child recorded by the
+// jth one bit, so children and parents are found by rank and select.
+//
+// Subtree sizes are sampled every sample_depth levels: a node on such a
+// level whose subtree reaches sample_depth levels further down is tall,
+// and the number of its descendants from that depth on is kept as a
+// prefix sum over the tall nodes. Each tall node owns a path through the
+// sample_depth levels below it, so there are at most n/sample_depth
+// samples. With a bit per node to mark the first node of each level and
+// one to mark the tall nodes, the samples add at most 4 bits per node to
+// the shape, and far less unless the tree is mostly long paths.
+template <typename T>
+class SuccinctTree
+{
+public:
+    // npos is the index returned for a node which does not exist.
+    static constexpr std::size_t npos = std::size_t(-1);
+
+    SuccinctTree() = default;
+
+    // SuccinctTree encodes the tree at root.
+    explicit SuccinctTree(const TreeNode<T>* root)
+    {
+        std::queue<std::pair<const TreeNode<T>*, std::size_t>> nodes;
+        std::vector<std::size_t> depths;
+        if (root) {
+            nodes.emplace(root, 0);
+        }
+        while (!nodes.empty()) {
+            auto [node, depth] = nodes.front();
+            nodes.pop();
+            levels.push_back(depths.empty() || depths.back() != depth);
+            depths.push_back(depth);
+            payload.push_back(node->data);
+            shape.push_back(bool(node->left));
+            shape.push_back(bool(node->right));
+            if (node->left) {
+                nodes.emplace(node->left.get(), depth + 1);
+            }
+            if (node->right) {
+                nodes.emplace(node->right.get(), depth + 1);
+            }
+        }
+        shape.build();
+        levels.build();
+        sample(depths);
+    }
+
+    // left returns the index of the left child of node i or npos.
+    std::size_t left(std::size_t i) const
+    {
+        return shape[2*i] ? shape.rank1(2*i) + 1 : npos;
+    }
+
+    // right returns the index of the right child of node i or npos.
+    std::size_t right(std::size_t i) const
+    {
+        return shape[2*i + 1] ? shape.rank1(2*i + 1) + 1 : npos;
+    }
+
+    // parent returns the index of the parent of node i or npos for the root.
+    std::size_t parent(std::size_t i) const
+    {
+        return i ? shape.select1(i)/2 : npos;
+    }
+
+    // subtree_size returns the number of nodes in the subtree at i.
+    // The descendants of i on each level are consecutive in level order,
+    // so each level costs two rank queries. Levels are counted down to
+    // the first sampled level and sample_depth levels past it, the rest
+    // of the subtree is the sum of the samples of the tall nodes among
+    // the descendants on the sampled level, so the cost is O(sample_depth)
+    // whatever the height of the subtree.
+    std::size_t subtree_size(std::size_t i) const
+    {
+        std::size_t size = 0;
+        auto lo = i;
+        auto hi = i + 1; // Nodes [lo, hi) on the current level.
+        auto next_level = [&] {
+            size += hi - lo;
+            lo = shape.rank1(2*lo) + 1;
+            hi = shape.rank1(2*hi) + 1;
+        };
+        for (auto depth = levels.rank1(i + 1) - 1; lo < hi && depth % sample_depth; ++depth) {
+            next_level();
+        }
+        if (lo < hi) {
+            size += deep[tall.rank1(hi)] - deep[tall.rank1(lo)];
+        }
+        for (std::size_t k = 0; lo < hi && k < sample_depth; ++k) {
+            next_level();
+        }
+        return size;
+    }
+
+    const T& operator[](std::size_t i) const
+    {
+        return payload[i];
+    }
+
+    // values returns the payload in level order.
+    const std::vector<T>& values() const
+    {
+        return payload;
+    }
+
+    // size returns the number of nodes in the tree.
+    std::size_t size() const
+    {
+        return payload.size();
+    }
+
+    // bytes returns the memory used by the shape, subtree size samples
+    // and payload.
+    std::size_t bytes() const
+    {
+        return shape.bytes() + levels.bytes() + tall.bytes() + deep.size()*sizeof(std::size_t)
+             + payload.size()*sizeof(T);
+    }
+
+private:
+    static constexpr std::size_t sample_depth = 32;
+
+    BitVector shape;
+    BitVector levels;             // Set for the first node of each level.
+    BitVector tall;               // Set for the tall nodes.
+    std::vector<std::size_t> deep = std::vector<std::size_t>(1); // Prefix sums over tall nodes.
+    std::vector<T> payload;
+
+    // sample finds the tall nodes given the depth of each node.
+    void sample(const std::vector<std::size_t>& depths)
+    {
+        // In reverse level order children come before their parents. For
+        // node j, below[j] counts the nodes of its subtree on and past the
+        // first sampled level deeper than j.
+        auto n = payload.size();
+        std::vector<std::size_t> sizes(n, 1);
+        std::vector<std::size_t> below(n, 0);
+        for (auto j = n; j-- > 0;) {
+            for (auto c : {left(j), right(j)}) {
+                if (c == npos) {
+                    continue;
+                }
+                sizes[j] += sizes[c];
+                below[j] += depths[c] % sample_depth ? below[c] : sizes[c];
+            }
+        }
+        for (std::size_t j = 0; j < n; ++j) {
+            bool is_tall = depths[j] % sample_depth == 0 && below[j];
+            tall.push_back(is_tall);
+            if (is_tall) {
+                deep.push_back(deep.back() + below[j]);
+            }
+        }
+        tall.build();
+    }
+};
+
+// make_tree returns a linked tree with the shape and values of tree.
+template <typename T>
+std::shared_ptr<TreeNode<T>>
+make_tree(const SuccinctTree<T>& tree)
+{
+    if (!tree.size()) {
+        return nullptr;
+    }
+    // Level order again: node i of tree is nodes[i].
+    std::vector<TreeNode<T>*> nodes(tree.size());
+    auto root = std::make_shared<TreeNode<T>>(tree[0]);
+    nodes[0] = root.get();
+    for (std::size_t i = 0; i < tree.size(); ++i) {
+        auto l = tree.left(i);
+        if (l != SuccinctTree<T>::npos) {
+            nodes[l] = nodes[i]->insert_left(tree[l]);
+        }
+        auto r = tree.right(i);
+        if (r != SuccinctTree<T>::npos) {
+            nodes[r] = nodes[i]->insert_right(tree[r]);
+        }
+    }
+    return root;
+}
+
+}
+
+TEST_CASE("[BitVector]")
+{
+    using namespace containers;
+
+    BitVector bits;
+    std::vector<bool> expected;
+    for (int i = 0; i < 3000; ++i) {
+        bool b = (i*7919) % 5 < 2;
+        bits.push_back(b);
+        expected.push_back(b);
+    }
+    bits.build();
+
+    std::size_t ones = 0;
+    for (std::size_t i = 0; i < expected.size(); ++i) {
+        REQUIRE(bits[i] == expected[i]);
+        REQUIRE(bits.rank1(i) == ones);
+        if (expected[i]) {
+            ++ones;
+            REQUIRE(bits.select1(ones) == i);
+        }
+    }
+    REQUIRE(bits.rank1(expected.size()) == ones);
+}
+
+TEST_CASE("[SuccinctTree]")
+{
+    using namespace containers;
+
+    std::vector<std::shared_ptr<TreeNode<int>>> trees;
+    for (int n : {0, 1, 2, 3, 6, 7, 8, 100, 2000}) {
+        std::vector<int> values(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = i;
+        }
+        trees.push_back(make_tree(values));
+    }
+    // Irregular shapes.
+    auto root = std::make_shared<TreeNode<int>>(0);
+    auto node = root.get();
+    for (int i = 1; i < 300; ++i) {
+        node = i % 3 ? node->insert_right(i) : node->insert_left(i);
+        if (i % 5 == 0) {
+            node->insert_left(-i);
+        }
+    }
+    trees.push_back(root);
+
+    for (const auto& t : trees) {
+        SuccinctTree<int> tree(t.get());
+        REQUIRE(tree.size() == tree_size(t.get()));
+        REQUIRE(tree.values() == make_vector(t.get()));
+
+        // Round trip through the linked representation.
+        auto rt = make_tree(tree);
+        REQUIRE(make_vector(rt.get()) == make_vector(t.get()));
+        REQUIRE(tree_height(rt.get()) == tree_height(t.get()));
+
+        // Navigation agrees with the linked tree, compared in level order.
+        std::vector<const TreeNode<int>*> nodes;
+        std::queue<const TreeNode<int>*> q;
+        if (t) {
+            q.push(t.get());
+        }
+        while (!q.empty()) {
+            auto n = q.front();
+            q.pop();
+            nodes.push_back(n);
+            if (n->left) {
+                q.push(n->left.get());
+            }
+            if (n->right) {
+                q.push(n->right.get());
+            }
+        }
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            auto l = tree.left(i);
+            auto r = tree.right(i);
+            REQUIRE((l != SuccinctTree<int>::npos) == bool(nodes[i]->left));
+            REQUIRE((r != SuccinctTree<int>::npos) == bool(nodes[i]->right));
+            if (l != SuccinctTree<int>::npos) {
+                REQUIRE(nodes[l] == nodes[i]->left.get());
+                REQUIRE(tree.parent(l) == i);
+            }
+            if (r != SuccinctTree<int>::npos) {
+                REQUIRE(nodes[r] == nodes[i]->right.get());
+                REQUIRE(tree.parent(r) == i);
+            }
+            REQUIRE(tree.subtree_size(i) == tree_size(nodes[i]));
+        }
+        if (tree.size()) {
+            REQUIRE(tree.parent(0) == SuccinctTree<int>::npos);
+        }
+    }
+}
+
+TEST_CASE("[SuccinctTree] subtree_size deep tree")
+{
+    using namespace containers;
+
+    // A long left path with short and long right branches, so that tall
+    // nodes are on and off the path and the subtree at most nodes is
+    // far deeper than sample_depth.
+    const int n = 200000;
+    auto root = std::make_shared<TreeNode<int>>(0);
+    auto node = root.get();
+    for (int i = 1; i < n; ++i) {
+        node = node->insert_left(i);
+        if (i % 3 == 0) {
+            auto branch = node->insert_right(-i);
+            for (int k = 0; k < (i % 1000 == 0 ? 100 : i % 7); ++k) {
+                branch = k % 2 ? branch->insert_left(-i) : branch->insert_right(-i);
+            }
+        }
+    }
+    SuccinctTree<int> tree(root.get());
+
+    // Children come after their parents in level order.
+    std::vector<std::size_t> sizes(tree.size(), 1);
+    for (auto i = tree.size(); i-- > 1;) {
+        sizes[tree.parent(i)] += sizes[i];
+    }
+    REQUIRE(sizes[0] == tree_size(root.get()));
+    for (std::size_t i = 0; i < tree.size(); ++i) {
+        REQUIRE(tree.subtree_size(i) == sizes[i]);
+    }
+}
+
+TEST_CASE("[SuccinctTree] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const std::size_t n = 1 << 20;
+    auto root = make_tree(std::vector<int>(n, 1));
+    SuccinctTree<int> tree;
+    MESSAGE("encode: " << elapsed_ms([&] { tree = SuccinctTree<int>(root.get()); }) << " ms");
+
+    // A make_shared node is the TreeNode plus its control block.
+    auto linked = sizeof(TreeNode<int>) + 2*sizeof(long);
+    MESSAGE("bytes/node TreeNode: ~" << linked
+            << " SuccinctTree: " << double(tree.bytes())/tree.size()
+            << " (shape bits/node: " << double(8*(tree.bytes() - n*sizeof(int)))/n << ")");
+
+    // Walk every root to leaf path along the leftmost children.
+    std::size_t v = 0;
+    MESSAGE("left spine walks TreeNode: " << elapsed_ms([&] {
+        for (int k = 0; k < 100000; ++k) {
+            for (auto node = root.get(); node; node = node->left.get()) {
+                v += node->data;
+            }
+        }
+    }) << " ms");
+    MESSAGE("left spine walks SuccinctTree: " << elapsed_ms([&] {
+        for (int k = 0; k < 100000; ++k) {
+            for (auto i = std::size_t(0); i != SuccinctTree<int>::npos; i = tree.left(i)) {
+                v += tree[i];
+            }
+        }
+    }) << " ms");
+    do_not_optimize(v);
+}
@@ -1,134 +1,17 @@
-#include <algorithm>
-#include <cstddef>
 #include <memory>
-#include <queue>
+#include <string>
 #include <vector>
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest/doctest.h"
 
+#include "containers/bench.h"
+#include "containers/tree.h"
+
 #if __has_include("containers/print.h")
 #   include "containers/print.h"
 #endif
 
-namespace containers
-{
-
-// TreeNode is a node in a binary tree.
-template <typename T>
-struct TreeNode
-{
-    using TreeNodePtr = std::shared_ptr<TreeNode<T>>;
-
-    TreeNode() = default;
-
-    TreeNode(const T& data)
-        : data(data)
-    { }
-
-    TreeNode<T>* insert_left(const T& data)
-    {
-        left = std::make_shared<TreeNode<T>>(data);
-        return left.get();
-    }
-
-    TreeNode<T>* insert_right(const T& data)
-    {
-        right = std::make_shared<TreeNode<T>>(data);
-        return right.get();
-    }
-
-    T data;
-    TreeNodePtr left;
-    TreeNodePtr right;
-};
-
-// make_tree returns a tree initailized from container of values.
-template <typename T>
-std::shared_ptr<TreeNode<T>>
-make_tree(const std::vector<T>& values)
-{
-    // Since this is a binary tree, there is no ordering wrt value.
-    // Values are inserted in level-order as they appear in the
-    // container of values; starting at root and growing downward
-    // adding sibling nodes from left to right.
-    std::shared_ptr<TreeNode<T>> root;
-
-    std::queue<TreeNode<T>*> nodes;
-    for (const auto& v : values) {
-        if (nodes.empty()) {
-            root = std::make_shared<TreeNode<T>>(v);
-            nodes.push(root.get());
-        }
-        else {
-            auto node = nodes.front();
-            if (!node->left) {
-                nodes.push(node->insert_left(v));
-            }
-            else {
-                nodes.push(node->insert_right(v));
-                nodes.pop(); // Both children populated.
-            }
-        }
-    }
-
-    return root;
-}
-
-// make_vector returns a vector initialized from tree.
-template <typename T>
-std::vector<T>
-make_vector(const TreeNode<T>* root)
-{
-    // Since this is a binary tree, there is no ordering wrt value.
-    // Values are inserted into the vector in the order they appear
-    // during a level order traversal of the tree.
-    std::vector<T> values;
-
-    std::queue<const TreeNode<T>*> nodes;
-    if (root) {
-        nodes.push(root);
-    }
-    while (!nodes.empty()) {
-        auto node = nodes.front();
-        values.emplace_back(node->data);
-        if (node->left) {
-            nodes.push(node->left.get());
-        }
-        if (node->right) {
-            nodes.push(node->right.get());
-        }
-        nodes.pop(); // Both children queued.
-    }
-
-    return values;
-}
-
-// tree_height returns the height of the tree.
-template <typename T>
-std::size_t
-tree_height(const TreeNode<T>* root)
-{
-    if (!root || (!root->left && !root->right)) {
-        // Null node or node with no children has 0 height.
-        return 0;
-    }
-    return 1 + std::max(tree_height(root->left.get()), tree_height(root->right.get()));
-}
-
-// tree_size returns the number of elements in the tree.
-template <typename T>
-std::size_t
-tree_size(const TreeNode<T>* root)
-{
-    if (!root) {
-        return 0;
-    }
-    return 1 + tree_size(root->left.get()) + tree_size(root->right.get());
-}
-
-}
-
 TEST_CASE("[make_tree]")
 {
     using namespace containers;
@@ -314,3 +197,114 @@ TEST_CASE("[tree_size]")
         REQUIRE(size == c.expected);
     }
 }
+
+namespace
+{
+
+// make_skewed returns a tree of n nodes where every node is a left child.
+std::shared_ptr<containers::TreeNode<int>> make_skewed(int n)
+{
+    auto root = std::make_shared<containers::TreeNode<int>>(0);
+    auto node = root.get();
+    for (int i = 1; i < n; ++i) {
+        node = node->insert_left(i);
+    }
+    return root;
+}
+
+}
+
+TEST_CASE("[tree_height] [tree_size] traversals agree")
+{
+    using namespace containers;
+
+    std::vector<std::shared_ptr<TreeNode<int>>> trees;
+    for (int n = 0; n < 20; ++n) {
+        std::vector<int> values(n);
+        trees.push_back(make_tree(values));
+    }
+    for (int n = 1; n < 20; ++n) {
+        trees.push_back(make_skewed(n));
+    }
+    // A zig-zag tree.
+    auto zigzag = std::make_shared<TreeNode<int>>(0);
+    auto node = zigzag.get();
+    for (int i = 1; i < 10; ++i) {
+        node = i % 2 ? node->insert_right(i) : node->insert_left(i);
+        node->insert_left(-i);
+    }
+    trees.push_back(zigzag);
+
+    TreeStack<int> stack;
+    for (const auto& root : trees) {
+        auto height = tree_height_recursive(root.get());
+        auto size = tree_size_recursive(root.get());
+        REQUIRE(tree_height(root.get()) == height);
+        REQUIRE(tree_height(root.get(), stack) == height);
+        REQUIRE(tree_height_morris(root.get()) == height);
+        REQUIRE(tree_size(root.get()) == size);
+        REQUIRE(tree_size(root.get(), stack) == size);
+        REQUIRE(tree_size_morris(root.get()) == size);
+    }
+
+    // The Morris traversals restore the tree.
+    auto root = make_tree(std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8});
+    tree_height_morris(root.get());
+    tree_size_morris(root.get());
+    REQUIRE(make_vector(root.get()) == std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8});
+}
+
+TEST_CASE("[tree_height] [tree_size] deep tree")
+{
+    using namespace containers;
+
+    // Deep enough to overflow the stack with one frame per level,
+    // both in the traversals and in the destructor.
+    const int n = 1000000;
+    auto root = make_skewed(n);
+    TreeStack<int> stack;
+    REQUIRE(tree_height(root.get(), stack) == std::size_t(n-1));
+    REQUIRE(tree_size(root.get(), stack) == std::size_t(n));
+    REQUIRE(tree_height_morris(root.get()) == std::size_t(n-1));
+    REQUIRE(tree_size_morris(root.get()) == std::size_t(n));
+}
+
+TEST_CASE("[tree_height] [tree_size] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    struct bench_case
+    {
+        std::string name;
+        std::shared_ptr<TreeNode<int>> root;
+    };
+
+    std::vector<bench_case> cases{
+        {"balanced", make_tree(std::vector<int>(1 << 20))},
+        // Shallow enough for the recursive version to survive.
+        {"skewed", make_skewed(50000)},
+    };
+
+    for (auto& c : cases) {
+        auto root = c.root.get();
+        TreeStack<int> stack;
+        std::size_t v = 0;
+        MESSAGE(c.name << " tree_height recursive: "
+                << elapsed_ms([&] { v += tree_height_recursive(root); }) << " ms");
+        MESSAGE(c.name << " tree_height stack: "
+                << elapsed_ms([&] { v += tree_height(root); }) << " ms");
+        MESSAGE(c.name << " tree_height reused stack: "
+                << elapsed_ms([&] { v += tree_height(root, stack); }) << " ms");
+        MESSAGE(c.name << " tree_height morris: "
+                << elapsed_ms([&] { v += tree_height_morris(root); }) << " ms");
+        MESSAGE(c.name << " tree_size recursive: "
+                << elapsed_ms([&] { v += tree_size_recursive(root); }) << " ms");
+        MESSAGE(c.name << " tree_size stack: "
+                << elapsed_ms([&] { v += tree_size(root); }) << " ms");
+        MESSAGE(c.name << " tree_size reused stack: "
+                << elapsed_ms([&] { v += tree_size(root, stack); }) << " ms");
+        MESSAGE(c.name << " tree_size morris: "
+                << elapsed_ms([&] { v += tree_size_morris(root); }) << " ms");
+        do_not_optimize(v);
+    }
+}
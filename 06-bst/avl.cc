@@ -0,0 +1,526 @@
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/avl.h"
+#include "containers/bench.h"
+#include "containers/bst.h"
+#include "containers/work_stealing.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+// is_avl returns true when the cached heights are correct and every node
+// is balanced and ordered.
+template <typename T, bool C>
+bool
+is_avl(const containers::AVLNode<T, C>* node, const T* lo = nullptr, const T* hi = nullptr)
+{
+    if (!node) {
+        return true;
+    }
+    if ((lo && !(*lo < node->data)) || (hi && !(node->data < *hi))) {
+        return false;
+    }
+    int lh = node->left ? node->left->height : -1;
+    int rh = node->right ? node->right->height : -1;
+    if constexpr (C) {
+        auto size = 1 + (node->left ? node->left->size : 0) + (node->right ? node->right->size : 0);
+        if (node->size != size) {
+            return false;
+        }
+    }
+    return node->height == 1 + std::max(lh, rh) && lh - rh <= 1 && rh - lh <= 1
+        && is_avl(node->left.get(), lo, &node->data)
+        && is_avl(node->right.get(), &node->data, hi);
+}
+
+TEST_CASE("[make_avl]")
+{
+    using namespace containers;
+
+    struct test_case
+    {
+        std::string name;
+        std::vector<int> values;
+        std::vector<int> preorder;
+        std::vector<int> inorder;
+        std::size_t height;
+    };
+
+    std::vector<test_case> test_cases{
+        {
+            "Empty tree.",
+            {},
+            {}, // pre
+            {}, // in
+            0,
+        },
+        {
+            "1 node.",
+            {1},
+            {1}, // pre
+            {1}, // in
+            0,
+        },
+        {
+            "3 node, ascending.",
+            {1, 2, 3},
+            {2, 1, 3}, // pre
+            {1, 2, 3}, // in
+            1,
+        },
+        {
+            "3 node, descending.",
+            {3, 2, 1},
+            {2, 1, 3}, // pre
+            {1, 2, 3}, // in
+            1,
+        },
+        {
+            "3 node, left right.",
+            {3, 1, 2},
+            {2, 1, 3}, // pre
+            {1, 2, 3}, // in
+            1,
+        },
+        {
+            "3 node, right left.",
+            {1, 3, 2},
+            {2, 1, 3}, // pre
+            {1, 2, 3}, // in
+            1,
+        },
+        {
+            "7 node, ascending.",
+            {1, 2, 3, 4, 5, 6, 7},
+            {4, 2, 1, 3, 6, 5, 7}, // pre
+            {1, 2, 3, 4, 5, 6, 7}, // in
+            2,
+        },
+        {
+            "Dupes.",
+            {2, 2, 1, 1, 3},
+            {2, 1, 3}, // pre
+            {1, 2, 3}, // in
+            1,
+        },
+    };
+
+    for (const auto& c : test_cases) {
+        INFO(c.name);
+        auto root = make_avl(c.values);
+        REQUIRE(make_vector(root.get(), Order::preorder) == c.preorder);
+        REQUIRE(make_vector(root.get(), Order::inorder) == c.inorder);
+        REQUIRE(tree_height(root.get()) == c.height);
+        REQUIRE(is_avl(root.get()));
+    }
+}
+
+TEST_CASE("[make_avl] height is logarithmic")
+{
+    using namespace containers;
+
+    const int n = 10000;
+    std::vector<int> sorted(n);
+    for (int i = 0; i < n; ++i) {
+        sorted[i] = i;
+    }
+    auto reversed = sorted;
+    std::reverse(reversed.begin(), reversed.end());
+    auto shuffled = sorted;
+    std::mt19937 gen(3);
+    std::shuffle(shuffled.begin(), shuffled.end(), gen);
+
+    for (const auto& values : {sorted, reversed, shuffled}) {
+        auto root = make_avl(values);
+        REQUIRE(is_avl(root.get()));
+        REQUIRE(make_vector(root.get()) == sorted);
+        // 1.44 log2(10000) < 20.
+        REQUIRE(tree_height(root.get()) < 20);
+        for (int v = -1; v <= n; ++v) {
+            auto node = find(root.get(), v);
+            if (v >= 0 && v < n) {
+                REQUIRE(node != nullptr);
+                REQUIRE(node->data == v);
+            }
+            else {
+                REQUIRE(node == nullptr);
+            }
+        }
+    }
+}
+
+TEST_CASE("[BSTIterator] AVLNode")
+{
+    using namespace containers;
+
+    std::vector<int> values{5, 1, 9, 3, 7, 2, 8};
+    auto root = make_avl(values);
+    std::sort(values.begin(), values.end());
+    REQUIRE(std::vector<int>(inorder_begin(root.get()), inorder_end(root.get())) == values);
+    REQUIRE(*lower_bound(root.get(), 4) == 5);
+    REQUIRE(*upper_bound(root.get(), 5) == 7);
+    REQUIRE(upper_bound(root.get(), 9) == inorder_end(root.get()));
+    std::vector<int> rcv;
+    range(root.get(), 2, 8, [&rcv](int v) { rcv.push_back(v); });
+    REQUIRE(rcv == std::vector<int>{2, 3, 5, 7});
+}
+
+TEST_CASE("[insert] returns node")
+{
+    using namespace containers;
+
+    std::shared_ptr<AVLNode<int>> root;
+    auto one = insert(root, 1);
+    REQUIRE(one == root.get());
+    auto two = insert(root, 2);
+    REQUIRE(two->data == 2);
+    auto three = insert(root, 3); // Rotates 2 to the root.
+    REQUIRE(three->data == 3);
+    REQUIRE(root.get() == two);
+    REQUIRE(insert(root, 1) == one);
+}
+
+TEST_CASE("[erase]")
+{
+    using namespace containers;
+
+    auto root = make_avl(std::vector<int>{1, 2, 3, 4, 5, 6, 7});
+    REQUIRE(!erase(root, 8));
+    REQUIRE(erase(root, 4)); // Root with two children.
+    REQUIRE(make_vector(root.get(), Order::preorder) == std::vector<int>{5, 2, 1, 3, 6, 7});
+    REQUIRE(erase(root, 1)); // Leaf.
+    REQUIRE(erase(root, 6)); // One child.
+    REQUIRE(make_vector(root.get()) == std::vector<int>{2, 3, 5, 7});
+    REQUIRE(is_avl(root.get()));
+    for (int v : {2, 3, 5, 7}) {
+        REQUIRE(erase(root, v));
+        REQUIRE(is_avl(root.get()));
+    }
+    REQUIRE(!root);
+    REQUIRE(!erase(root, 1));
+}
+
+TEST_CASE("[erase] NodePool")
+{
+    using namespace containers;
+
+    NodePool<CountedAVLNode<int>> pool;
+    std::shared_ptr<CountedAVLNode<int>> root;
+    std::set<int> expected;
+    std::mt19937 gen(21);
+    for (int i = 0; i < 20000; ++i) {
+        int v = int(gen() % 1000);
+        if (gen() % 2) {
+            insert(root, v, pool);
+            expected.insert(v);
+        }
+        else {
+            REQUIRE(erase(root, v, pool) == bool(expected.erase(v)));
+        }
+        if (i % 1000 == 0) {
+            REQUIRE(is_avl(root.get()));
+        }
+    }
+    REQUIRE(make_vector(root.get()) == std::vector<int>(expected.begin(), expected.end()));
+    REQUIRE(tree_size(root.get()) == expected.size());
+
+    // Reused nodes start as fresh leaves.
+    auto n = tree_size(root.get());
+    REQUIRE(erase(root, *expected.begin(), pool));
+    REQUIRE(pool.size() > 0);
+    auto node = insert(root, -1, pool);
+    REQUIRE(node->height == 0);
+    REQUIRE(node->size == 1);
+    REQUIRE(tree_size(root.get()) == n);
+    REQUIRE(is_avl(root.get()));
+}
+
+TEST_CASE("[select] [rank]")
+{
+    using namespace containers;
+
+    // Random inserts and erases, checked against std::set.
+    std::shared_ptr<CountedAVLNode<int>> root;
+    std::set<int> expected;
+    std::mt19937 gen(9);
+    for (int i = 0; i < 20000; ++i) {
+        int v = int(gen() % 2000);
+        if (gen() % 3) {
+            insert(root, v);
+            expected.insert(v);
+        }
+        else {
+            REQUIRE(erase(root, v) == bool(expected.erase(v)));
+        }
+        if (i % 1000 == 0) {
+            REQUIRE(is_avl(root.get()));
+            REQUIRE(tree_size(root.get()) == expected.size());
+            std::size_t k = 0;
+            for (auto e : expected) {
+                REQUIRE(select(root.get(), k)->data == e);
+                REQUIRE(rank(root.get(), e) == k);
+                REQUIRE(rank(root.get(), e + 1) == k + 1);
+                ++k;
+            }
+            REQUIRE(select(root.get(), k) == nullptr);
+        }
+    }
+
+    // The 99th percentile of 1..1000.
+    std::vector<int> latencies(1000);
+    for (int i = 0; i < 1000; ++i) {
+        latencies[i] = 1000 - i;
+    }
+    auto counted = make_avl<int, true>(latencies);
+    REQUIRE(select(counted.get(), tree_size(counted.get())*99/100)->data == 991);
+    REQUIRE(rank(counted.get(), 991) == 990);
+    REQUIRE(rank(counted.get(), 0) == 0);
+    REQUIRE(rank(counted.get(), 2000) == 1000);
+    REQUIRE(select(static_cast<const CountedAVLNode<int>*>(nullptr), 0) == nullptr);
+
+    // Without counts the node is no larger than before.
+    REQUIRE(sizeof(AVLNode<int>) < sizeof(CountedAVLNode<int>));
+}
+
+TEST_CASE("[tree_union] [tree_intersection] [tree_difference]")
+{
+    using namespace containers;
+
+    // Sizes of the two sets, from empty to very different.
+    std::vector<std::pair<int, int>> sizes{
+        {0, 0}, {0, 50}, {50, 0}, {1, 1}, {1, 1000}, {1000, 1}, {30, 3000}, {500, 700}, {3000, 3000}};
+
+    TaskPool pool(4);
+    std::mt19937 gen(17);
+    for (auto [na, nb] : sizes) {
+        INFO(na << " " << nb);
+        std::set<int> a;
+        std::set<int> b;
+        while (int(a.size()) < na) {
+            a.insert(int(gen() % 8000));
+        }
+        while (int(b.size()) < nb) {
+            b.insert(int(gen() % 8000));
+        }
+        std::vector<int> va(a.begin(), a.end());
+        std::vector<int> vb(b.begin(), b.end());
+        std::vector<int> expected_union;
+        std::vector<int> expected_intersection;
+        std::vector<int> expected_difference;
+        std::set_union(va.begin(), va.end(), vb.begin(), vb.end(), std::back_inserter(expected_union));
+        std::set_intersection(va.begin(), va.end(), vb.begin(), vb.end(),
+                              std::back_inserter(expected_intersection));
+        std::set_difference(va.begin(), va.end(), vb.begin(), vb.end(), std::back_inserter(expected_difference));
+
+        // Insert in random order so the trees have different shapes.
+        std::shuffle(va.begin(), va.end(), gen);
+        std::shuffle(vb.begin(), vb.end(), gen);
+
+        auto root = tree_union(make_avl<int, true>(va), make_avl<int, true>(vb));
+        REQUIRE(make_vector(root.get()) == expected_union);
+        REQUIRE(is_avl(root.get()));
+        root = tree_intersection(make_avl<int, true>(va), make_avl<int, true>(vb));
+        REQUIRE(make_vector(root.get()) == expected_intersection);
+        REQUIRE(is_avl(root.get()));
+        root = tree_difference(make_avl<int, true>(va), make_avl<int, true>(vb));
+        REQUIRE(make_vector(root.get()) == expected_difference);
+        REQUIRE(is_avl(root.get()));
+
+        // A small grain splits even these trees into many tasks.
+        auto proot = tree_union(pool, make_avl(va), make_avl(vb), 4);
+        REQUIRE(make_vector(proot.get()) == expected_union);
+        REQUIRE(is_avl(proot.get()));
+        proot = tree_intersection(pool, make_avl(va), make_avl(vb), 4);
+        REQUIRE(make_vector(proot.get()) == expected_intersection);
+        REQUIRE(is_avl(proot.get()));
+        proot = tree_difference(pool, make_avl(va), make_avl(vb), 4);
+        REQUIRE(make_vector(proot.get()) == expected_difference);
+        REQUIRE(is_avl(proot.get()));
+    }
+}
+
+TEST_CASE("[select] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 20;
+    std::vector<int> values(n);
+    std::mt19937 gen(1);
+    for (auto& v : values) {
+        v = int(gen());
+    }
+    auto root = make_avl<int, true>(values);
+
+    // The 99th percentile after each of 100 updates.
+    long sum = 0;
+    MESSAGE("make_vector percentile: " << elapsed_ms([&] {
+        for (int i = 0; i < 100; ++i) {
+            insert(root, int(gen()));
+            auto all = make_vector(root.get());
+            sum += all[all.size()*99/100];
+        }
+    }) << " ms");
+    MESSAGE("select percentile: " << elapsed_ms([&] {
+        for (int i = 0; i < 100; ++i) {
+            insert(root, int(gen()));
+            sum += select(root.get(), tree_size(root.get())*99/100)->data;
+        }
+    }) << " ms");
+    MESSAGE("1M rank: " << elapsed_ms([&] {
+        for (int i = 0; i < 1000000; ++i) {
+            sum += rank(root.get(), int(gen()));
+        }
+    }) << " ms");
+    do_not_optimize(sum);
+}
+
+TEST_CASE("[erase] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 20;
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = 2*i;
+    }
+    std::mt19937 gen(1);
+    std::shuffle(values.begin(), values.end(), gen);
+    std::vector<int> churn(1000000);
+    for (auto& v : churn) {
+        v = 2*int(gen() % n);
+    }
+
+    // Erase a random value and insert it again, 1M times.
+    auto root = make_avl(values);
+    MESSAGE("AVLNode make_shared: " << elapsed_ms([&] {
+        for (auto v : churn) {
+            erase(root, v);
+            insert(root, v);
+        }
+    }) << " ms");
+    NodePool<AVLNode<int>> pool;
+    MESSAGE("AVLNode NodePool: " << elapsed_ms([&] {
+        for (auto v : churn) {
+            erase(root, v, pool);
+            insert(root, v, pool);
+        }
+    }) << " ms");
+}
+
+TEST_CASE("[tree_union] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 20;
+    std::mt19937 gen(1);
+    std::vector<int> big(n);
+    for (auto& v : big) {
+        v = int(gen());
+    }
+
+    for (int m : {1 << 10, 1 << 20}) {
+        std::vector<int> delta(m);
+        for (auto& v : delta) {
+            v = int(gen());
+        }
+
+        // Flatten both trees, merge and rebuild.
+        auto a = make_avl(big);
+        auto b = make_avl(delta);
+        std::shared_ptr<AVLNode<int>> root;
+        auto flatten_ms = elapsed_ms([&] {
+            auto va = make_vector(a.get());
+            auto vb = make_vector(b.get());
+            std::vector<int> merged;
+            merged.reserve(va.size() + vb.size());
+            std::set_union(va.begin(), va.end(), vb.begin(), vb.end(), std::back_inserter(merged));
+            root = make_avl(merged);
+        });
+        root = make_avl(big);
+        auto insert_ms = elapsed_ms([&] {
+            for (auto v : delta) {
+                insert(root, v);
+            }
+        });
+        root.reset();
+        auto join_ms = elapsed_ms([&] {
+            root = tree_union(std::move(a), std::move(b));
+        });
+        MESSAGE(m << " into " << n << ": flatten and rebuild " << flatten_ms
+                << " ms, insert " << insert_ms << " ms, tree_union " << join_ms << " ms");
+
+        auto nmax = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned nthreads = 1; nthreads <= nmax; nthreads *= 2) {
+            TaskPool pool(nthreads);
+            root.reset();
+            a = make_avl(big);
+            b = make_avl(delta);
+            auto ms = elapsed_ms([&] {
+                root = tree_union(pool, std::move(a), std::move(b));
+            });
+            MESSAGE(m << " into " << n << ": tree_union " << nthreads << " threads " << ms << " ms");
+        }
+        do_not_optimize(root);
+    }
+}
+
+TEST_CASE("[make_avl] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    // BSTNode::insert recurses once per level, so sorted input is kept small.
+    for (int n : {10000, 1000000}) {
+        std::vector<int> sorted(n);
+        for (int i = 0; i < n; ++i) {
+            sorted[i] = i;
+        }
+        auto reversed = sorted;
+        std::reverse(reversed.begin(), reversed.end());
+        auto shuffled = sorted;
+        std::mt19937 gen(1);
+        std::shuffle(shuffled.begin(), shuffled.end(), gen);
+
+        struct input
+        {
+            std::string name;
+            const std::vector<int>& values;
+        };
+        for (const auto& in : {input{"sorted", sorted}, input{"reversed", reversed},
+                               input{"random", shuffled}}) {
+            std::size_t found = 0;
+            if (n <= 10000 || in.name == "random") {
+                std::shared_ptr<BSTNode<int>> bst;
+                auto build = elapsed_ms([&] { bst = make_bst(in.values); });
+                auto lookup = elapsed_ms([&] {
+                    for (auto v : shuffled) {
+                        found += find(bst.get(), v) != nullptr;
+                    }
+                });
+                MESSAGE("BSTNode " << in.name << " n=" << n << ": make_bst " << build
+                        << " ms, find all " << lookup << " ms, height " << tree_height(bst.get()));
+            }
+            std::shared_ptr<AVLNode<int>> avl;
+            auto build = elapsed_ms([&] { avl = make_avl(in.values); });
+            auto lookup = elapsed_ms([&] {
+                for (auto v : shuffled) {
+                    found += find(avl.get(), v) != nullptr;
+                }
+            });
+            MESSAGE("AVLNode " << in.name << " n=" << n << ": make_avl " << build
+                    << " ms, find all " << lookup << " ms, height " << tree_height(avl.get()));
+            do_not_optimize(found);
+        }
+    }
+}
@@ -0,0 +1,762 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/avl.h"
+#include "containers/bench.h"
+#include "containers/bst.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// lower_index returns the index of the first of the n sorted keys which
+// is not less than v. The loop has no data dependent branches, so its
+// cost does not depend on how predictable the searches are.
+template <typename T>
+std::size_t
+lower_index(const T* keys, std::size_t n, const T& v)
+{
+    if (!n) {
+        return 0;
+    }
+    auto base = keys;
+    while (n > 1) {
+        auto half = n/2;
+        base = base[half - 1] < v ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + (*base < v);
+}
+
+// upper_index returns the index of the first of the n sorted keys which
+// is greater than v.
+template <typename T>
+std::size_t
+upper_index(const T* keys, std::size_t n, const T& v)
+{
+    if (!n) {
+        return 0;
+    }
+    auto base = keys;
+    while (n > 1) {
+        auto half = n/2;
+        base = v < base[half - 1] ? base : base + half;
+        n -= half;
+    }
+    return (base - keys) + !(v < *base);
+}
+
+// BPlusTree is an ordered set of keys stored in the leaves of a B+tree.
+// Each node fills NodeBytes, a multiple of the cache line size, so a
+// search costs one node of a few cache lines per level instead of a
+// cache miss per key compared. The leaves are linked left to right so
+// iterating over a range reads consecutive keys.
+template <typename T, std::size_t NodeBytes = 256>
+class BPlusTree
+{
+    static constexpr std::size_t cache_line = 64;
+    static_assert(NodeBytes % cache_line == 0, "NodeBytes must be a multiple of the cache line size");
+
+    struct Node
+    {
+        std::uint32_t count = 0; // Number of keys.
+        bool leaf = true;
+    };
+
+public:
+    // Nodes hold one key above capacity while they are split.
+    static constexpr std::size_t leaf_capacity =
+        (NodeBytes - sizeof(Node) - sizeof(void*))/sizeof(T) - 1;
+    static constexpr std::size_t inner_capacity =
+        (NodeBytes - sizeof(Node) - sizeof(void*))/(sizeof(T) + sizeof(void*)) - 1;
+    static_assert(leaf_capacity >= 3 && inner_capacity >= 3, "NodeBytes too small for T");
+
+private:
+    struct alignas(cache_line) Leaf : Node
+    {
+        T keys[leaf_capacity + 1];
+        Leaf* next = nullptr;
+    };
+
+    struct alignas(cache_line) Inner : Node
+    {
+        Inner() { this->leaf = false; }
+
+        T keys[inner_capacity + 1];
+        Node* children[inner_capacity + 2];
+    };
+
+public:
+    // const_iterator visits the keys in order by following the leaf links.
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+
+        reference operator*() const
+        {
+            return leaf->keys[i];
+        }
+
+        pointer operator->() const
+        {
+            return &leaf->keys[i];
+        }
+
+        const_iterator& operator++()
+        {
+            if (++i == leaf->count) {
+                leaf = leaf->next;
+                i = 0;
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            auto it = *this;
+            ++*this;
+            return it;
+        }
+
+        bool operator==(const const_iterator& rhs) const
+        {
+            return leaf == rhs.leaf && i == rhs.i;
+        }
+
+        bool operator!=(const const_iterator& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    private:
+        friend class BPlusTree;
+
+        const_iterator(const Leaf* leaf, std::size_t i) : leaf(leaf), i(i)
+        {
+            // A position past the end of a leaf is the start of the next.
+            if (this->leaf && this->i == this->leaf->count) {
+                this->leaf = this->leaf->next;
+                this->i = 0;
+            }
+        }
+
+        const Leaf* leaf = nullptr;
+        std::size_t i = 0;
+    };
+
+    BPlusTree() : root(new Leaf()) { }
+
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    ~BPlusTree()
+    {
+        destroy(root);
+    }
+
+    // insert adds v and returns true, or returns false if already present.
+    // If allocating a node throws, the tree is left unchanged.
+    bool insert(const T& v)
+    {
+        // Nodes split only along a path of full nodes, so every node the
+        // insert might need is allocated before any node is changed.
+        std::unique_ptr<Inner> inner;
+        if (full(root)) {
+            inner.reset(new Inner());
+        }
+        bool inserted = false;
+        T sep;
+        auto right = insert(root, v, sep, inserted);
+        if (right) {
+            // The root split, so the tree grows one level.
+            inner->count = 1;
+            inner->keys[0] = sep;
+            inner->children[0] = root;
+            inner->children[1] = right;
+            root = inner.release();
+            ++levels;
+        }
+        nkeys += inserted;
+        return inserted;
+    }
+
+    // erase removes v and returns true, or returns false if not present.
+    bool erase(const T& v)
+    {
+        if (!erase(root, v)) {
+            return false;
+        }
+        if (!root->leaf && !root->count) {
+            // The root has a single child left, so the tree shrinks.
+            auto inner = static_cast<Inner*>(root);
+            root = inner->children[0];
+            delete inner;
+            --levels;
+        }
+        --nkeys;
+        return true;
+    }
+
+    // find returns an iterator to v or end if not present.
+    const_iterator find(const T& v) const
+    {
+        auto it = lower_bound(v);
+        if (it != end() && !(v < *it)) {
+            return it;
+        }
+        return end();
+    }
+
+    bool contains(const T& v) const
+    {
+        return find(v) != end();
+    }
+
+    // lower_bound returns an iterator to the first key not less than v.
+    const_iterator lower_bound(const T& v) const
+    {
+        auto leaf = find_leaf(v);
+        return const_iterator(leaf, lower_index(leaf->keys, leaf->count, v));
+    }
+
+    // upper_bound returns an iterator to the first key greater than v.
+    const_iterator upper_bound(const T& v) const
+    {
+        auto leaf = find_leaf(v);
+        return const_iterator(leaf, upper_index(leaf->keys, leaf->count, v));
+    }
+
+    const_iterator begin() const
+    {
+        auto node = root;
+        while (!node->leaf) {
+            node = static_cast<const Inner*>(node)->children[0];
+        }
+        return const_iterator(static_cast<const Leaf*>(node), 0);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator();
+    }
+
+    // size returns the number of keys.
+    std::size_t size() const
+    {
+        return nkeys;
+    }
+
+    bool empty() const
+    {
+        return !nkeys;
+    }
+
+    // height returns the number of inner levels above the leaves.
+    std::size_t height() const
+    {
+        return levels;
+    }
+
+private:
+    static constexpr std::size_t leaf_min = leaf_capacity/2;
+    static constexpr std::size_t inner_min = inner_capacity/2;
+
+    Node* root;
+    std::size_t nkeys = 0;
+    std::size_t levels = 0;
+
+    static void destroy(Node* node)
+    {
+        if (node->leaf) {
+            delete static_cast<Leaf*>(node);
+            return;
+        }
+        auto inner = static_cast<Inner*>(node);
+        for (std::size_t i = 0; i <= inner->count; ++i) {
+            destroy(inner->children[i]);
+        }
+        delete inner;
+    }
+
+    // full returns whether node would split if it gained a key.
+    static bool full(const Node* node)
+    {
+        return node->count == (node->leaf ? leaf_capacity : inner_capacity);
+    }
+
+    // find_leaf returns the leaf whose range of keys includes v. Every
+    // key in children[i] is at least keys[i-1] and less than keys[i].
+    const Leaf* find_leaf(const T& v) const
+    {
+        auto node = root;
+        while (!node->leaf) {
+            auto inner = static_cast<const Inner*>(node);
+            node = inner->children[upper_index(inner->keys, inner->count, v)];
+        }
+        return static_cast<const Leaf*>(node);
+    }
+
+    template <typename U>
+    static void insert_at(U* a, std::size_t n, std::size_t i, const U& v)
+    {
+        std::copy_backward(a + i, a + n, a + n + 1);
+        a[i] = v;
+    }
+
+    template <typename U>
+    static void remove_at(U* a, std::size_t n, std::size_t i)
+    {
+        std::copy(a + i + 1, a + n, a + i);
+    }
+
+    // insert adds v below node. When node splits, the new right sibling
+    // is returned and sep is set to the least key in its subtree. A
+    // sibling is allocated before node is changed, so node is unchanged
+    // if the allocation throws.
+    Node* insert(Node* node, const T& v, T& sep, bool& inserted)
+    {
+        if (node->leaf) {
+            auto leaf = static_cast<Leaf*>(node);
+            auto i = lower_index(leaf->keys, leaf->count, v);
+            if (i < leaf->count && !(v < leaf->keys[i])) {
+                return nullptr; // Ignore dupes.
+            }
+            std::unique_ptr<Leaf> right;
+            if (full(leaf)) {
+                right.reset(new Leaf());
+            }
+            insert_at(leaf->keys, leaf->count++, i, v);
+            inserted = true;
+            if (!right) {
+                return nullptr;
+            }
+            auto mid = leaf->count/2;
+            std::copy(leaf->keys + mid, leaf->keys + leaf->count, right->keys);
+            right->count = leaf->count - mid;
+            leaf->count = mid;
+            right->next = leaf->next;
+            leaf->next = right.get();
+            sep = right->keys[0];
+            return right.release();
+        }
+
+        auto inner = static_cast<Inner*>(node);
+        auto i = upper_index(inner->keys, inner->count, v);
+        std::unique_ptr<Inner> right;
+        if (full(inner) && full(inner->children[i])) {
+            right.reset(new Inner());
+        }
+        T child_sep;
+        auto child = insert(inner->children[i], v, child_sep, inserted);
+        if (!child) {
+            return nullptr;
+        }
+        insert_at(inner->children, inner->count + 1, i + 1, child);
+        insert_at(inner->keys, inner->count++, i, child_sep);
+        if (!right) {
+            return nullptr;
+        }
+        // The middle key moves up and the keys either side of it split.
+        auto mid = inner->count/2;
+        sep = inner->keys[mid];
+        std::copy(inner->keys + mid + 1, inner->keys + inner->count, right->keys);
+        std::copy(inner->children + mid + 1, inner->children + inner->count + 1, right->children);
+        right->count = inner->count - mid - 1;
+        inner->count = mid;
+        return right.release();
+    }
+
+    // erase removes v below node and refills any child left underfull.
+    bool erase(Node* node, const T& v)
+    {
+        if (node->leaf) {
+            auto leaf = static_cast<Leaf*>(node);
+            auto i = lower_index(leaf->keys, leaf->count, v);
+            if (i == leaf->count || v < leaf->keys[i]) {
+                return false;
+            }
+            remove_at(leaf->keys, leaf->count--, i);
+            return true;
+        }
+
+        auto inner = static_cast<Inner*>(node);
+        auto i = upper_index(inner->keys, inner->count, v);
+        if (!erase(inner->children[i], v)) {
+            return false;
+        }
+        auto child = inner->children[i];
+        if (child->count < (child->leaf ? leaf_min : inner_min)) {
+            refill(inner, i);
+        }
+        return true;
+    }
+
+    // refill moves a key into the underfull child i of parent from a
+    // sibling, or merges it with a sibling which has no key to spare.
+    void refill(Inner* parent, std::size_t i)
+    {
+        auto min = parent->children[i]->leaf ? leaf_min : inner_min;
+        if (i > 0 && parent->children[i - 1]->count > min) {
+            borrow_left(parent, i);
+        }
+        else if (i < parent->count && parent->children[i + 1]->count > min) {
+            borrow_right(parent, i);
+        }
+        else {
+            // Merge the right one of a pair of siblings into the left one.
+            merge(parent, i > 0 ? i - 1 : i);
+        }
+    }
+
+    void borrow_left(Inner* parent, std::size_t i)
+    {
+        if (parent->children[i]->leaf) {
+            auto left = static_cast<Leaf*>(parent->children[i - 1]);
+            auto leaf = static_cast<Leaf*>(parent->children[i]);
+            insert_at(leaf->keys, leaf->count++, 0, left->keys[--left->count]);
+            parent->keys[i - 1] = leaf->keys[0];
+            return;
+        }
+        auto left = static_cast<Inner*>(parent->children[i - 1]);
+        auto inner = static_cast<Inner*>(parent->children[i]);
+        insert_at(inner->children, inner->count + 1, 0, left->children[left->count]);
+        insert_at(inner->keys, inner->count++, 0, parent->keys[i - 1]);
+        parent->keys[i - 1] = left->keys[--left->count];
+    }
+
+    void borrow_right(Inner* parent, std::size_t i)
+    {
+        if (parent->children[i]->leaf) {
+            auto leaf = static_cast<Leaf*>(parent->children[i]);
+            auto right = static_cast<Leaf*>(parent->children[i + 1]);
+            leaf->keys[leaf->count++] = right->keys[0];
+            remove_at(right->keys, right->count--, 0);
+            parent->keys[i] = right->keys[0];
+            return;
+        }
+        auto inner = static_cast<Inner*>(parent->children[i]);
+        auto right = static_cast<Inner*>(parent->children[i + 1]);
+        inner->keys[inner->count++] = parent->keys[i];
+        inner->children[inner->count] = right->children[0];
+        parent->keys[i] = right->keys[0];
+        remove_at(right->keys, right->count, 0);
+        remove_at(right->children, right->count + 1, 0);
+        --right->count;
+    }
+
+    // merge moves children i+1 of parent into children i.
+    void merge(Inner* parent, std::size_t i)
+    {
+        if (parent->children[i]->leaf) {
+            auto left = static_cast<Leaf*>(parent->children[i]);
+            auto right = static_cast<Leaf*>(parent->children[i + 1]);
+            std::copy(right->keys, right->keys + right->count, left->keys + left->count);
+            left->count += right->count;
+            left->next = right->next;
+            delete right;
+        }
+        else {
+            auto left = static_cast<Inner*>(parent->children[i]);
+            auto right = static_cast<Inner*>(parent->children[i + 1]);
+            left->keys[left->count] = parent->keys[i];
+            std::copy(right->keys, right->keys + right->count, left->keys + left->count + 1);
+            std::copy(right->children, right->children + right->count + 1,
+                      left->children + left->count + 1);
+            left->count += 1 + right->count;
+            delete right;
+        }
+        remove_at(parent->keys, parent->count, i);
+        remove_at(parent->children, parent->count + 1, i + 1);
+        --parent->count;
+    }
+};
+
+}
+
+namespace
+{
+
+// allocations_left is the number of allocations which succeed before
+// operator new throws, or negative for no limit.
+long allocations_left = -1;
+
+void* allocate(std::size_t n, std::size_t align)
+{
+    if (allocations_left == 0) {
+        throw std::bad_alloc{};
+    }
+    if (allocations_left > 0) {
+        --allocations_left;
+    }
+    auto p = align > alignof(std::max_align_t)
+           ? std::aligned_alloc(align, (n + align - 1)/align*align)
+           : std::malloc(n ? n : 1);
+    if (!p) {
+        throw std::bad_alloc{};
+    }
+    return p;
+}
+
+}
+
+void* operator new(std::size_t n)
+{
+    return allocate(n, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t n, std::align_val_t align)
+{
+    return allocate(n, std::size_t(align));
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+TEST_CASE("[lower_index] [upper_index]")
+{
+    using namespace containers;
+
+    std::vector<int> keys{1, 3, 3, 5, 7, 9, 11};
+    for (std::size_t n = 0; n <= keys.size(); ++n) {
+        for (int v = 0; v <= 12; ++v) {
+            auto end = keys.begin() + n;
+            REQUIRE(lower_index(keys.data(), n, v) == std::size_t(std::lower_bound(keys.begin(), end, v) - keys.begin()));
+            REQUIRE(upper_index(keys.data(), n, v) == std::size_t(std::upper_bound(keys.begin(), end, v) - keys.begin()));
+        }
+    }
+}
+
+TEST_CASE("[BPlusTree]")
+{
+    using namespace containers;
+
+    // Small nodes give a deep tree which exercises every split and merge.
+    BPlusTree<int, 64> tree;
+    std::set<int> expected;
+    REQUIRE(tree.empty());
+    REQUIRE(tree.begin() == tree.end());
+    REQUIRE(tree.find(1) == tree.end());
+    REQUIRE(!tree.erase(1));
+
+    std::mt19937 gen(5);
+    const int n = 5000;
+    for (int i = 0; i < 4*n; ++i) {
+        int v = int(gen() % n);
+        REQUIRE(tree.insert(v) == expected.insert(v).second);
+    }
+    REQUIRE(tree.size() == expected.size());
+    REQUIRE(tree.height() > 2);
+    REQUIRE(std::vector<int>(tree.begin(), tree.end()) == std::vector<int>(expected.begin(), expected.end()));
+    for (int v = -1; v <= n; ++v) {
+        REQUIRE(tree.contains(v) == bool(expected.count(v)));
+        auto lb = tree.lower_bound(v);
+        auto elb = expected.lower_bound(v);
+        REQUIRE((lb == tree.end()) == (elb == expected.end()));
+        if (elb != expected.end()) {
+            REQUIRE(*lb == *elb);
+        }
+        auto ub = tree.upper_bound(v);
+        auto eub = expected.upper_bound(v);
+        REQUIRE((ub == tree.end()) == (eub == expected.end()));
+        if (eub != expected.end()) {
+            REQUIRE(*ub == *eub);
+        }
+    }
+
+    // Interleave erase and insert, then drain the tree.
+    for (int i = 0; i < 4*n; ++i) {
+        int v = int(gen() % n);
+        if (i % 3) {
+            REQUIRE(tree.erase(v) == bool(expected.erase(v)));
+        }
+        else {
+            REQUIRE(tree.insert(v) == expected.insert(v).second);
+        }
+        REQUIRE(tree.size() == expected.size());
+    }
+    REQUIRE(std::vector<int>(tree.begin(), tree.end()) == std::vector<int>(expected.begin(), expected.end()));
+    for (int v = 0; v < n; ++v) {
+        REQUIRE(tree.erase(v) == bool(expected.erase(v)));
+    }
+    REQUIRE(tree.empty());
+    REQUIRE(tree.height() == 0);
+    REQUIRE(tree.begin() == tree.end());
+
+    // Sorted input and a range scan.
+    BPlusTree<long> sorted;
+    for (long v = 0; v < 100000; ++v) {
+        REQUIRE(sorted.insert(v));
+    }
+    long sum = 0;
+    for (auto it = sorted.lower_bound(1000); it != sorted.end() && *it < 2000; ++it) {
+        sum += *it;
+    }
+    REQUIRE(sum == (1000 + 1999)*1000/2);
+    REQUIRE(*sorted.find(99999) == 99999);
+}
+
+TEST_CASE("[BPlusTree] allocation throws")
+{
+    using namespace containers;
+
+    // Small nodes split often. Every insert fails at some allocation
+    // until the limit is large enough, and each failed insert must leave
+    // the tree as it was.
+    BPlusTree<int, 64> tree;
+    std::set<int> expected;
+    std::mt19937 gen(7);
+    const int n = 3000;
+    std::size_t failed = 0;
+    for (int i = 0; i < n; ++i) {
+        int v = int(gen() % (4*n));
+        for (long limit = 0;; ++limit) {
+            allocations_left = limit;
+            try {
+                bool inserted = tree.insert(v);
+                allocations_left = -1;
+                REQUIRE(inserted == expected.insert(v).second);
+                break;
+            }
+            catch (const std::bad_alloc&) {
+                allocations_left = -1;
+                ++failed;
+                REQUIRE(tree.size() == expected.size());
+                REQUIRE(tree.contains(v) == bool(expected.count(v)));
+            }
+        }
+    }
+    REQUIRE(failed > 0);
+    REQUIRE(tree.height() > 2);
+    REQUIRE(tree.size() == expected.size());
+    REQUIRE(std::vector<int>(tree.begin(), tree.end()) == std::vector<int>(expected.begin(), expected.end()));
+    for (auto v : expected) {
+        REQUIRE(tree.contains(v));
+    }
+}
+
+TEST_CASE("[BPlusTree] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    // Larger sizes are limited by the memory of std::set and BSTNode.
+    for (int n : {1000000, 10000000}) {
+        std::vector<int> values(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = 2*i;
+        }
+        std::mt19937 gen(1);
+        std::shuffle(values.begin(), values.end(), gen);
+        std::vector<int> keys(1000000);
+        for (auto& k : keys) {
+            k = int(gen() % (2*n));
+        }
+        std::size_t found = 0;
+
+        if (n <= 1000000) {
+            std::shared_ptr<BSTNode<int>> bst;
+            auto build = elapsed_ms([&] { bst = make_bst(values); });
+            auto lookup = elapsed_ms([&] {
+                for (auto k : keys) {
+                    found += find(bst.get(), k) != nullptr;
+                }
+            });
+            MESSAGE("BSTNode n=" << n << ": insert " << build << " ms, find " << lookup << " ms");
+
+            std::shared_ptr<AVLNode<int>> avl;
+            build = elapsed_ms([&] { avl = make_avl(values); });
+            lookup = elapsed_ms([&] {
+                for (auto k : keys) {
+                    found += find(avl.get(), k) != nullptr;
+                }
+            });
+            MESSAGE("AVLNode n=" << n << ": insert " << build << " ms, find " << lookup << " ms");
+        }
+
+        {
+            std::set<int> set;
+            auto build = elapsed_ms([&] { set.insert(values.begin(), values.end()); });
+            auto lookup = elapsed_ms([&] {
+                for (auto k : keys) {
+                    found += set.find(k) != set.end();
+                }
+            });
+            long sum = 0;
+            auto scan = elapsed_ms([&] {
+                for (auto v : set) {
+                    sum += v;
+                }
+            });
+            do_not_optimize(sum);
+            MESSAGE("std::set n=" << n << ": insert " << build << " ms, find " << lookup
+                    << " ms, scan " << scan << " ms");
+        }
+
+        {
+            BPlusTree<int> tree;
+            auto build = elapsed_ms([&] {
+                for (auto v : values) {
+                    tree.insert(v);
+                }
+            });
+            auto lookup = elapsed_ms([&] {
+                for (auto k : keys) {
+                    found += tree.contains(k);
+                }
+            });
+            long sum = 0;
+            auto scan = elapsed_ms([&] {
+                for (auto v : tree) {
+                    sum += v;
+                }
+            });
+            do_not_optimize(sum);
+            auto erase = elapsed_ms([&] {
+                for (auto v : values) {
+                    tree.erase(v);
+                }
+            });
+            MESSAGE("BPlusTree n=" << n << ": insert " << build << " ms, find " << lookup
+                    << " ms, scan " << scan << " ms, erase " << erase << " ms");
+        }
+        do_not_optimize(found);
+    }
+}
@@ -1,90 +1,43 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <iterator>
 #include <memory>
+#include <random>
+#include <set>
+#include <string>
 #include <vector>
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest/doctest.h"
 
+#include "containers/bench.h"
+#include "containers/bst.h"
+#include "containers/work_stealing.h"
+
 #if __has_include("containers/print.h")
 #   include "containers/print.h"
 #endif
 
-namespace containers
-{
-
-// BSTNode is a node in a binary search tree.
-template <typename T>
-struct BSTNode
-{
-    using BSTNodePtr = std::shared_ptr<BSTNode<T>>;
-
-    BSTNode() = default;
-
-    BSTNode(const T& data) : data(data) { }
-
-    BSTNode<T>* insert(const T& v)
-    {
-        if (v < data) {
-            if (left) {
-                return left->insert(v);
-            }
-            left = std::make_shared<BSTNode<T>>(v);
-            return left.get();
-        }
-        else if (v > data) {
-            if (right) {
-                return right->insert(v);
-            }
-            right = std::make_shared<BSTNode<T>>(v);
-            return right.get();
-        }
-        return this; // Ignore dupes.
-    }
-
-    T data;
-    BSTNodePtr left;
-    BSTNodePtr right;
-};
-
-// make_bst returns bst initialized from container of values.
-template <typename T>
-std::shared_ptr<BSTNode<T>>
-make_bst(const std::vector<T>& values)
-{
-    std::shared_ptr<BSTNode<T>> root;
-
-    for (const auto& v : values) {
-        if (!root) {
-            root = std::make_shared<BSTNode<T>>(v);
-        }
-        else {
-            root->insert(v);
-        }
-    }
-
-    return root;
-}
-
-// Order is a traversal order.
-enum Order { preorder, inorder, postorder };
-
-// make_vector returns vector initialized from tree.
-template <typename T>
+// make_vector_function is make_vector as it was written with recursive
+// std::function visitors, kept as a baseline for the benchmark.
+template <typename T, typename Node>
 std::vector<T>
-make_vector(const BSTNode<T>* root, const Order& order=inorder)
+make_vector_function(const Node* root, containers::Order order)
 {
     std::vector<T> values;
     if (!root) {
         return values;
     }
 
-    using VisitFunc = std::function<void(const BSTNode<T>*)>;
+    using VisitFunc = std::function<void(const Node*)>;
 
     // Insert elements according to requested traversal order.
     switch(order) {
-    case Order::preorder:
+    case containers::Order::preorder:
         {
-        VisitFunc visit_pre = [&values, &visit_pre](const BSTNode<T>* node) {
+        VisitFunc visit_pre = [&values, &visit_pre](const Node* node) {
             values.push_back(node->data);
             if (node->left) {
                 visit_pre(node->left.get());
@@ -96,9 +49,9 @@ make_vector(const BSTNode<T>* root, const Order& order=inorder)
         visit_pre(root);
         break;
         }
-    case Order::inorder:
+    case containers::Order::inorder:
         {
-        VisitFunc visit_in = [&values, &visit_in](const BSTNode<T>* node) {
+        VisitFunc visit_in = [&values, &visit_in](const Node* node) {
             if (node->left) {
                 visit_in(node->left.get());
             }
@@ -110,9 +63,9 @@ make_vector(const BSTNode<T>* root, const Order& order=inorder)
         visit_in(root);
         break;
         }
-    case Order::postorder:
+    case containers::Order::postorder:
         {
-        VisitFunc visit_post = [&values, &visit_post](const BSTNode<T>* node) {
+        VisitFunc visit_post = [&values, &visit_post](const Node* node) {
             if (node->left) {
                 visit_post(node->left.get());
             }
@@ -129,31 +82,6 @@ make_vector(const BSTNode<T>* root, const Order& order=inorder)
     return values;
 }
 
-// find returns the node containig value or nullptr if not in tree.
-template <typename T>
-const BSTNode<T>*
-find(const BSTNode<T>* root, const T& v)
-{
-    if (!root) {
-        return nullptr;
-    }
-    if (v < root->data) {
-        if (root->left) {
-            return find(root->left.get(), v);
-        }
-        return nullptr;
-    }
-    else if (v > root->data) {
-        if (root->right) {
-            return find(root->right.get(), v);
-        }
-        return nullptr;
-    }
-    return root; // v == data.
-}
-
-}
-
 TEST_CASE("[make_bst]")
 {
     using namespace containers;
@@ -283,3 +211,458 @@ TEST_CASE("[find]")
         }
     }
 }
+
+TEST_CASE("[make_bst_sorted]")
+{
+    using namespace containers;
+
+    TaskPool pool(4);
+    for (int n : {0, 1, 2, 3, 7, 8, 100, 4097}) {
+        INFO(n);
+        std::vector<int> values(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = 2*i;
+        }
+        // Perfectly balanced: height floor(log2(n)).
+        std::size_t height = 0;
+        while ((std::size_t(2) << height) <= std::size_t(n)) {
+            ++height;
+        }
+        for (auto root : {make_bst_sorted(values), make_bst_sorted(pool, values, 16)}) {
+            REQUIRE(make_vector(root.get()) == values);
+            REQUIRE(tree_height(root.get()) == height);
+            for (int v = -1; v <= 2*n; ++v) {
+                REQUIRE((find(root.get(), v) != nullptr) == (v >= 0 && v < 2*n && v % 2 == 0));
+            }
+            if (root) {
+                // The nodes are allocated in one block.
+                std::vector<std::uintptr_t> addrs;
+                std::vector<const BSTNode<int>*> stack{root.get()};
+                while (!stack.empty()) {
+                    auto node = stack.back();
+                    stack.pop_back();
+                    addrs.push_back(std::uintptr_t(node));
+                    for (auto c : {node->left.get(), node->right.get()}) {
+                        if (c) {
+                            stack.push_back(c);
+                        }
+                    }
+                }
+                auto [lo, hi] = std::minmax_element(addrs.begin(), addrs.end());
+                REQUIRE(*hi - *lo < 4*sizeof(BSTNode<int>)*n);
+            }
+        }
+    }
+
+    // Duplicates are ignored.
+    auto root = make_bst_sorted(std::vector<int>{1, 1, 2, 3, 3, 3});
+    REQUIRE(make_vector(root.get()) == std::vector<int>{1, 2, 3});
+
+    // Unsorted values are rejected.
+    REQUIRE_THROWS_AS(make_bst_sorted(std::vector<int>{1, 3, 2}), values_not_sorted_error);
+
+    // A subtree outlives the tree it was built in, and the tree still
+    // accepts inserts.
+    root = make_bst_sorted(std::vector<int>{1, 2, 3, 4, 5, 6, 7});
+    root->insert(8);
+    auto right = root->right;
+    root.reset();
+    REQUIRE(make_vector(right.get()) == std::vector<int>{5, 6, 7, 8});
+}
+
+TEST_CASE("[traverse]")
+{
+    using namespace containers;
+
+    auto root = make_bst(std::vector<int>{4, 2, 1, 3, 6, 5, 7});
+    struct test_case
+    {
+        Order order;
+        std::vector<int> expected;
+    };
+    std::vector<test_case> test_cases{
+        {Order::preorder, {4, 2, 1, 3, 6, 5, 7}},
+        {Order::inorder, {1, 2, 3, 4, 5, 6, 7}},
+        {Order::postorder, {1, 3, 2, 5, 7, 6, 4}},
+    };
+
+    BSTStack<BSTNode<int>> stack;
+    for (const auto& c : test_cases) {
+        INFO(c.order);
+        std::vector<int> rcv;
+        REQUIRE(traverse(root.get(), c.order, [&rcv](const BSTNode<int>* node) {
+            rcv.push_back(node->data);
+        }, stack));
+        REQUIRE(rcv == c.expected);
+
+        // Stop after k nodes, in each order.
+        for (std::size_t k = 1; k <= c.expected.size(); ++k) {
+            rcv.clear();
+            bool done = traverse(root.get(), c.order, [&rcv, k](const BSTNode<int>* node) {
+                rcv.push_back(node->data);
+                return rcv.size() < k;
+            }, stack);
+            REQUIRE(done == false);
+            REQUIRE(rcv == std::vector<int>(c.expected.begin(), c.expected.begin() + k));
+        }
+
+        REQUIRE(traverse(static_cast<const BSTNode<int>*>(nullptr), c.order,
+                         [](const BSTNode<int>*) { return false; }));
+    }
+
+    // A skewed tree is traversed without recursion.
+    std::shared_ptr<BSTNode<int>> chain;
+    const int n = 200000;
+    for (int i = n - 1; i >= 0; --i) {
+        auto node = std::make_shared<BSTNode<int>>(i);
+        node->right = std::move(chain);
+        chain = std::move(node);
+    }
+    long sum = 0;
+    for (auto order : {Order::preorder, Order::inorder, Order::postorder}) {
+        traverse(chain.get(), order, [&sum](const BSTNode<int>* node) { sum += node->data; }, stack);
+    }
+    REQUIRE(sum == 3L*n*(n - 1)/2);
+    REQUIRE(make_vector(chain.get()).size() == std::size_t(n));
+    while (chain) {
+        chain = std::move(chain->right); // Release the chain without recursing.
+    }
+}
+
+TEST_CASE("[erase]")
+{
+    using namespace containers;
+
+    struct test_case
+    {
+        std::string name;
+        std::vector<int> values;
+        int erase;
+        bool erased;
+        std::vector<int> preorder;
+    };
+
+    std::vector<test_case> test_cases{
+        {"Empty tree.", {}, 1, false, {}},
+        {"Missing value.", {2, 1, 3}, 4, false, {2, 1, 3}},
+        {"Only node.", {1}, 1, true, {}},
+        {"Leaf.", {2, 1, 3}, 1, true, {2, 3}},
+        {"Left child only.", {3, 2, 1}, 2, true, {3, 1}},
+        {"Right child only.", {1, 2, 3}, 2, true, {1, 3}},
+        {"Root, successor is right child.", {2, 1, 3}, 2, true, {3, 1}},
+        {"Root, successor deeper.", {4, 2, 6, 5, 7}, 4, true, {5, 2, 6, 7}},
+        {"Successor with right child.", {4, 2, 8, 6, 7, 9}, 4, true, {6, 2, 8, 7, 9}},
+    };
+
+    for (const auto& c : test_cases) {
+        INFO(c.name);
+        auto root = make_bst(c.values);
+        REQUIRE(erase(root, c.erase) == c.erased);
+        REQUIRE(make_vector(root.get(), Order::preorder) == c.preorder);
+    }
+
+    // Random churn, checked against std::set.
+    std::shared_ptr<BSTNode<int>> root;
+    NodePool<BSTNode<int>> pool;
+    std::set<int> expected;
+    std::mt19937 gen(13);
+    for (int i = 0; i < 20000; ++i) {
+        int v = int(gen() % 500);
+        if (gen() % 2) {
+            insert(root, v, pool);
+            expected.insert(v);
+        }
+        else {
+            REQUIRE(erase(root, v, pool) == bool(expected.erase(v)));
+        }
+    }
+    REQUIRE(make_vector(root.get()) == std::vector<int>(expected.begin(), expected.end()));
+
+    // A deep chain is erased from without recursing.
+    std::shared_ptr<BSTNode<int>> chain;
+    const int n = 200000;
+    for (int i = 0; i < n; ++i) {
+        insert(chain, i, pool);
+    }
+    REQUIRE(erase(chain, n - 1, pool));
+    for (int i = 0; i < n - 1; ++i) {
+        REQUIRE(erase(chain, i, pool));
+    }
+    REQUIRE(!chain);
+}
+
+TEST_CASE("[NodePool]")
+{
+    using namespace containers;
+
+    NodePool<BSTNode<int>> pool;
+    std::shared_ptr<BSTNode<int>> root;
+    insert(root, 2, pool);
+    auto one = insert(root, 1, pool);
+    insert(root, 3, pool);
+    REQUIRE(pool.size() == 0);
+
+    // An erased node is reused by the next insert.
+    REQUIRE(erase(root, 1, pool));
+    REQUIRE(pool.size() == 1);
+    auto four = insert(root, 4, pool);
+    REQUIRE(four == one);
+    REQUIRE(pool.size() == 0);
+    REQUIRE(make_vector(root.get(), Order::preorder) == std::vector<int>{2, 3, 4});
+    REQUIRE(four->left == nullptr);
+    REQUIRE(four->right == nullptr);
+
+    // A node still held elsewhere is not reused.
+    auto held = root->right;
+    REQUIRE(erase(root, 3, pool));
+    REQUIRE(pool.size() == 0);
+    REQUIRE(held->data == 3);
+    REQUIRE(erase(root, 4, pool));
+    REQUIRE(pool.size() == 1);
+    pool.shrink_to_fit();
+    REQUIRE(pool.size() == 0);
+}
+
+TEST_CASE("[BSTIterator]")
+{
+    using namespace containers;
+
+    std::mt19937 gen(11);
+    for (int n : {0, 1, 2, 3, 10, 500}) {
+        INFO(n);
+        std::vector<int> values(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = 3*i;
+        }
+        auto shuffled = values;
+        std::shuffle(shuffled.begin(), shuffled.end(), gen);
+        auto root = make_bst(shuffled);
+
+        // Forward and backward in order.
+        REQUIRE(std::vector<int>(inorder_begin(root.get()), inorder_end(root.get())) == values);
+        std::vector<int> backward;
+        for (auto it = inorder_end(root.get()); it != inorder_begin(root.get()); ) {
+            backward.push_back(*--it);
+        }
+        REQUIRE(std::vector<int>(backward.rbegin(), backward.rend()) == values);
+
+        for (int v = -1; v <= 3*n; ++v) {
+            auto lb = lower_bound(root.get(), v);
+            auto elb = std::lower_bound(values.begin(), values.end(), v);
+            REQUIRE(std::vector<int>(lb, inorder_end(root.get())) == std::vector<int>(elb, values.end()));
+            auto ub = upper_bound(root.get(), v);
+            auto eub = std::upper_bound(values.begin(), values.end(), v);
+            REQUIRE(std::vector<int>(ub, inorder_end(root.get())) == std::vector<int>(eub, values.end()));
+            if (lb != inorder_begin(root.get())) {
+                REQUIRE(*std::prev(lb) == *std::prev(elb));
+            }
+        }
+    }
+}
+
+TEST_CASE("[range]")
+{
+    using namespace containers;
+
+    auto root = make_bst(std::vector<int>{50, 20, 80, 10, 30, 70, 90, 25, 35, 75});
+    struct test_case
+    {
+        int lo;
+        int hi;
+        std::vector<int> expected;
+    };
+    std::vector<test_case> test_cases{
+        {0, 100, {10, 20, 25, 30, 35, 50, 70, 75, 80, 90}},
+        {25, 75, {25, 30, 35, 50, 70}},
+        {26, 76, {30, 35, 50, 70, 75}},
+        {91, 100, {}},
+        {0, 10, {}},
+        {40, 40, {}},
+        {35, 36, {35}},
+    };
+    for (const auto& c : test_cases) {
+        std::vector<int> rcv;
+        range(root.get(), c.lo, c.hi, [&rcv](int v) { rcv.push_back(v); });
+        REQUIRE(rcv == c.expected);
+    }
+    range(static_cast<const BSTNode<int>*>(nullptr), 0, 1, [](int) { REQUIRE(false); });
+
+    // Only the search paths and the values in range are read.
+    auto big = make_bst_sorted([] {
+        std::vector<int> v(1 << 16);
+        for (int i = 0; i < int(v.size()); ++i) {
+            v[i] = i;
+        }
+        return v;
+    }());
+    int count = 0;
+    range(big.get(), 1000, 1100, [&count](int) { ++count; });
+    REQUIRE(count == 100);
+}
+
+TEST_CASE("[range] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 20;
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = i;
+    }
+    auto root = make_bst_sorted(values);
+
+    // Sum 1000 ranges of 100 values.
+    long sum = 0;
+    MESSAGE("make_vector and scan: " << elapsed_ms([&] {
+        for (int q = 0; q < 1000; ++q) {
+            auto all = make_vector(root.get());
+            auto lo = std::lower_bound(all.begin(), all.end(), q*1000);
+            for (auto it = lo; it != all.end() && *it < q*1000 + 100; ++it) {
+                sum += *it;
+            }
+        }
+    }) << " ms");
+    MESSAGE("range: " << elapsed_ms([&] {
+        for (int q = 0; q < 1000; ++q) {
+            range(root.get(), q*1000, q*1000 + 100, [&sum](int v) { sum += v; });
+        }
+    }) << " ms");
+    MESSAGE("lower_bound and iterate: " << elapsed_ms([&] {
+        for (int q = 0; q < 1000; ++q) {
+            for (auto it = lower_bound(root.get(), q*1000); it != inorder_end(root.get()) && *it < q*1000 + 100; ++it) {
+                sum += *it;
+            }
+        }
+    }) << " ms");
+    do_not_optimize(sum);
+}
+
+TEST_CASE("[make_bst_sorted] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 22;
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = i;
+    }
+    auto shuffled = values;
+    std::mt19937 gen(1);
+    std::shuffle(shuffled.begin(), shuffled.end(), gen);
+    std::vector<int> keys(1000000);
+    for (auto& k : keys) {
+        k = int(gen() % n);
+    }
+
+    // make_bst on sorted values is quadratic, so it builds from shuffled.
+    std::shared_ptr<BSTNode<int>> root;
+    MESSAGE("make_bst shuffled: " << elapsed_ms([&] { root = make_bst(shuffled); }) << " ms");
+    std::size_t found = 0;
+    MESSAGE("find: " << elapsed_ms([&] {
+        for (auto k : keys) {
+            found += find(root.get(), k) != nullptr;
+        }
+    }) << " ms");
+
+    root.reset();
+    MESSAGE("make_bst_sorted: " << elapsed_ms([&] { root = make_bst_sorted(values); }) << " ms");
+    MESSAGE("find: " << elapsed_ms([&] {
+        for (auto k : keys) {
+            found += find(root.get(), k) != nullptr;
+        }
+    }) << " ms");
+    root.reset();
+
+    auto nmax = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned nthreads = 1; nthreads <= nmax; nthreads *= 2) {
+        TaskPool pool(nthreads);
+        auto ms = elapsed_ms([&] { root = make_bst_sorted(pool, values); });
+        MESSAGE("make_bst_sorted " << nthreads << " threads: " << ms << " ms");
+        root.reset();
+    }
+    do_not_optimize(found);
+}
+
+TEST_CASE("[traverse] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 22;
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = i;
+    }
+    auto root = make_bst_sorted(values);
+
+    // A large tree, then a small one which stays in cache traversed 1000 times.
+    auto small = make_bst_sorted(std::vector<int>(values.begin(), values.begin() + 4096));
+    for (auto order : {Order::preorder, Order::inorder, Order::postorder}) {
+        std::vector<int> v;
+        auto ms = elapsed_ms([&] { v = make_vector_function<int>(root.get(), order); });
+        MESSAGE("make_vector std::function order " << order << ": " << ms << " ms");
+        ms = elapsed_ms([&] { v = make_vector(root.get(), order); });
+        MESSAGE("make_vector traverse order " << order << ": " << ms << " ms");
+        ms = elapsed_ms([&] {
+            for (int i = 0; i < 1000; ++i) {
+                v = make_vector_function<int>(small.get(), order);
+            }
+        });
+        MESSAGE("small make_vector std::function order " << order << ": " << ms << " ms");
+        ms = elapsed_ms([&] {
+            for (int i = 0; i < 1000; ++i) {
+                v = make_vector(small.get(), order);
+            }
+        });
+        MESSAGE("small make_vector traverse order " << order << ": " << ms << " ms");
+    }
+
+    // Sum with a reused stack, and stop at the first value above n/100.
+    BSTStack<BSTNode<int>> stack;
+    long sum = 0;
+    MESSAGE("traverse sum: " << elapsed_ms([&] {
+        traverse(root.get(), Order::inorder, [&sum](const BSTNode<int>* node) { sum += node->data; }, stack);
+    }) << " ms");
+    MESSAGE("traverse first 1%: " << elapsed_ms([&] {
+        traverse(root.get(), Order::inorder, [&sum, n](const BSTNode<int>* node) {
+            sum += node->data;
+            return node->data < n/100;
+        }, stack);
+    }) << " ms");
+    do_not_optimize(sum);
+}
+
+TEST_CASE("[erase] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 20;
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = 2*i;
+    }
+    std::mt19937 gen(1);
+    std::shuffle(values.begin(), values.end(), gen);
+
+    // Erase a random value and insert a new one, 1M times.
+    std::vector<int> churn(1000000);
+    for (auto& v : churn) {
+        v = int(gen() % n);
+    }
+    auto run = [&](auto& root, auto&& erase_value, auto&& insert_value) {
+        return elapsed_ms([&] {
+            for (auto v : churn) {
+                erase_value(root, 2*v);
+                insert_value(root, 2*v);
+            }
+        });
+    };
+
+    auto root = make_bst(values);
+    MESSAGE("BSTNode make_shared: " << run(root,
+        [](auto& r, int v) { erase(r, v); },
+        [](auto& r, int v) { if (!r) { r = std::make_shared<BSTNode<int>>(v); } else { r->insert(v); } }) << " ms");
+    NodePool<BSTNode<int>> pool;
+    MESSAGE("BSTNode NodePool: " << run(root,
+        [&pool](auto& r, int v) { erase(r, v, pool); },
+        [&pool](auto& r, int v) { insert(r, v, pool); }) << " ms");
+}
@@ -0,0 +1,563 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/bst.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// ConcurrentBST is an ordered map which any number of threads may read and
+// update at once, built for workloads which are mostly lookups.
+//
+// Keys are never moved or unlinked once in the tree: a new key is linked
+// by a compare and swap on the empty child slot where it belongs, and an
+// erased key stays as a tombstone which a later insert of the key revives.
+// So a lookup follows child pointers without locks or validation, and no
+// node is freed before the tree. Memory grows with the number of distinct
+// keys ever inserted and the tree is not rebalanced, as for BSTNode.
+//
+// The value and presence of a key are guarded by a version per node used
+// as a sequence lock. A writer makes the version odd while it updates the
+// node, which is the only lock it takes. A reader copies the node state
+// and retries if the version changed meanwhile, so it never writes to
+// shared memory.
+template <typename K, typename V>
+class ConcurrentBST
+{
+    static_assert(std::is_trivially_copyable_v<V> && std::is_default_constructible_v<V>,
+                  "values are copied word by word while they may be written");
+
+    using Word = std::uintptr_t;
+
+    static constexpr std::size_t words = (sizeof(V) + sizeof(Word) - 1)/sizeof(Word);
+
+    struct Node
+    {
+        Node(const K& key, const V& value) : key(key)
+        {
+            store(value);
+        }
+
+        // store copies v into the words of the value.
+        void store(const V& v)
+        {
+            Word buf[words] = {};
+            std::memcpy(buf, &v, sizeof(V));
+            for (std::size_t i = 0; i < words; ++i) {
+                value[i].store(buf[i], std::memory_order_relaxed);
+            }
+        }
+
+        // load copies the words of the value, which may be torn if a
+        // writer holds the node.
+        V load() const
+        {
+            Word buf[words];
+            for (std::size_t i = 0; i < words; ++i) {
+                buf[i] = value[i].load(std::memory_order_relaxed);
+            }
+            V v;
+            std::memcpy(&v, buf, sizeof(V));
+            return v;
+        }
+
+        const K key;
+        std::atomic<Node*> left{nullptr};
+        std::atomic<Node*> right{nullptr};
+        std::atomic<std::uint64_t> version{0}; // Odd while a writer holds the node.
+        std::atomic<bool> present{true};
+        std::atomic<Word> value[words]; // The bytes of the value, as words.
+    };
+
+public:
+    ConcurrentBST() = default;
+
+    ConcurrentBST(const ConcurrentBST&) = delete;
+    ConcurrentBST& operator=(const ConcurrentBST&) = delete;
+
+    ~ConcurrentBST()
+    {
+        std::vector<Node*> stack;
+        if (auto node = root.load(std::memory_order_relaxed)) {
+            stack.push_back(node);
+        }
+        while (!stack.empty()) {
+            auto node = stack.back();
+            stack.pop_back();
+            if (auto left = node->left.load(std::memory_order_relaxed)) {
+                stack.push_back(left);
+            }
+            if (auto right = node->right.load(std::memory_order_relaxed)) {
+                stack.push_back(right);
+            }
+            delete node;
+        }
+    }
+
+    // find returns the value of key or nullopt if key is not in the map.
+    std::optional<V> find(const K& key) const
+    {
+        auto node = lookup(key);
+        return node ? read(node) : std::nullopt;
+    }
+
+    bool contains(const K& key) const
+    {
+        auto node = lookup(key);
+        return node && node->present.load(std::memory_order_acquire);
+    }
+
+    // insert adds key with value and returns true, or returns false if key
+    // is already in the map.
+    bool insert(const K& key, const V& value)
+    {
+        return update(key, value, false);
+    }
+
+    // insert_or_assign sets the value of key, adding it if needed. Returns
+    // true if key was added.
+    bool insert_or_assign(const K& key, const V& value)
+    {
+        return update(key, value, true);
+    }
+
+    // erase removes key and returns true if it was in the map.
+    bool erase(const K& key)
+    {
+        auto node = lookup(key);
+        if (!node) {
+            return false;
+        }
+        lock(node);
+        auto erased = node->present.load(std::memory_order_relaxed);
+        if (erased) {
+            node->present.store(false, std::memory_order_relaxed);
+            count.fetch_sub(1, std::memory_order_relaxed);
+        }
+        unlock(node);
+        return erased;
+    }
+
+    // for_each calls visit(key, value) in key order. Updates made during
+    // the traversal may or may not be seen.
+    template <typename Visit>
+    void for_each(Visit visit) const
+    {
+        std::vector<const Node*> stack;
+        const Node* node = root.load(std::memory_order_acquire);
+        while (node || !stack.empty()) {
+            while (node) {
+                stack.push_back(node);
+                node = node->left.load(std::memory_order_acquire);
+            }
+            node = stack.back();
+            stack.pop_back();
+            if (auto value = read(node)) {
+                visit(node->key, *value);
+            }
+            node = node->right.load(std::memory_order_acquire);
+        }
+    }
+
+    // size returns the number of keys in the map.
+    std::size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+private:
+    // read returns the value of node or nullopt if its key is erased,
+    // retrying until no writer updated the node while it was copied.
+    static std::optional<V> read(const Node* node)
+    {
+        for (;;) {
+            auto version = node->version.load(std::memory_order_acquire);
+            if (version & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            auto present = node->present.load(std::memory_order_relaxed);
+            auto value = node->load();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (node->version.load(std::memory_order_relaxed) == version) {
+                return present ? std::optional<V>(value) : std::nullopt;
+            }
+        }
+    }
+
+    // lookup returns the node of key, present or not, or nullptr.
+    Node* lookup(const K& key) const
+    {
+        auto node = root.load(std::memory_order_acquire);
+        while (node) {
+            if (key < node->key) {
+                node = node->left.load(std::memory_order_acquire);
+            }
+            else if (node->key < key) {
+                node = node->right.load(std::memory_order_acquire);
+            }
+            else {
+                break;
+            }
+        }
+        return node;
+    }
+
+    // update links a new node for key or revives or, if assign, updates
+    // the node already there. Returns true if key was added.
+    bool update(const K& key, const V& value, bool assign)
+    {
+        std::unique_ptr<Node> fresh;
+        auto slot = &root;
+        for (;;) {
+            auto node = slot->load(std::memory_order_acquire);
+            if (!node) {
+                if (!fresh) {
+                    fresh = std::make_unique<Node>(key, value);
+                }
+                if (slot->compare_exchange_strong(node, fresh.get(), std::memory_order_release,
+                                                  std::memory_order_acquire)) {
+                    fresh.release();
+                    count.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                // Another writer linked a node here first, go on below it.
+            }
+            if (key < node->key) {
+                slot = &node->left;
+            }
+            else if (node->key < key) {
+                slot = &node->right;
+            }
+            else {
+                lock(node);
+                auto added = !node->present.load(std::memory_order_relaxed);
+                if (added || assign) {
+                    node->present.store(true, std::memory_order_relaxed);
+                    node->store(value);
+                }
+                if (added) {
+                    count.fetch_add(1, std::memory_order_relaxed);
+                }
+                unlock(node);
+                return added;
+            }
+        }
+    }
+
+    // lock makes the version of node odd, waiting for other writers.
+    static void lock(Node* node)
+    {
+        auto version = node->version.load(std::memory_order_relaxed);
+        for (;;) {
+            if (version & 1) {
+                std::this_thread::yield();
+                version = node->version.load(std::memory_order_relaxed);
+            }
+            else if (node->version.compare_exchange_weak(version, version + 1, std::memory_order_acquire,
+                                                         std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        // Readers who see the updates below also see the odd version.
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void unlock(Node* node)
+    {
+        node->version.fetch_add(1, std::memory_order_release);
+    }
+
+    std::atomic<Node*> root{nullptr};
+    std::atomic<std::size_t> count{0};
+};
+
+// make_vector returns vector of the keys of map in order.
+template <typename K, typename V>
+std::vector<K>
+make_vector(const ConcurrentBST<K, V>& map)
+{
+    std::vector<K> keys;
+    map.for_each([&keys](const K& key, const V&) { keys.push_back(key); });
+    return keys;
+}
+
+}
+
+TEST_CASE("[ConcurrentBST]")
+{
+    using namespace containers;
+
+    ConcurrentBST<int, int> map;
+    REQUIRE(map.size() == 0);
+    REQUIRE(!map.find(1));
+    REQUIRE(!map.erase(1));
+
+    REQUIRE(map.insert(2, 20));
+    REQUIRE(!map.insert(2, 21)); // Insert keeps the value.
+    REQUIRE(*map.find(2) == 20);
+    REQUIRE(!map.insert_or_assign(2, 22));
+    REQUIRE(*map.find(2) == 22);
+    REQUIRE(map.insert_or_assign(1, 10));
+    REQUIRE(map.insert(3, 30));
+    REQUIRE(make_vector(map) == std::vector<int>{1, 2, 3});
+
+    // Erased keys are revived by insert.
+    REQUIRE(map.erase(2));
+    REQUIRE(!map.erase(2));
+    REQUIRE(!map.contains(2));
+    REQUIRE(!map.find(2));
+    REQUIRE(map.size() == 2);
+    REQUIRE(make_vector(map) == std::vector<int>{1, 3});
+    REQUIRE(map.insert(2, 23));
+    REQUIRE(*map.find(2) == 23);
+    REQUIRE(map.size() == 3);
+
+    // Random operations, checked against std::map.
+    ConcurrentBST<int, int> random;
+    std::map<int, int> expected;
+    std::mt19937 gen(9);
+    for (int i = 0; i < 20000; ++i) {
+        int k = int(gen() % 500);
+        int v = int(gen());
+        switch (gen() % 4) {
+        case 0:
+            REQUIRE(random.insert(k, v) == expected.insert({k, v}).second);
+            break;
+        case 1:
+            REQUIRE(random.insert_or_assign(k, v) == expected.insert_or_assign(k, v).second);
+            break;
+        case 2:
+            REQUIRE(random.erase(k) == bool(expected.erase(k)));
+            break;
+        default: {
+            auto it = expected.find(k);
+            auto found = random.find(k);
+            REQUIRE(bool(found) == (it != expected.end()));
+            REQUIRE((!found || *found == it->second));
+            break;
+        }
+        }
+    }
+    REQUIRE(random.size() == expected.size());
+    std::vector<int> keys;
+    for (const auto& [k, v] : expected) {
+        keys.push_back(k);
+    }
+    REQUIRE(make_vector(random) == keys);
+}
+
+TEST_CASE("[ConcurrentBST] concurrent updates")
+{
+    using namespace containers;
+
+    // Writers insert disjoint keys and erase half of them again.
+    const int nthreads = 4;
+    const int nkeys = 5000;
+    ConcurrentBST<int, int> map;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < nthreads; ++t) {
+        writers.emplace_back([&map, t] {
+            std::vector<int> keys;
+            for (int i = t; i < nthreads*nkeys; i += nthreads) {
+                keys.push_back(i);
+            }
+            std::shuffle(keys.begin(), keys.end(), std::mt19937(t));
+            for (auto k : keys) {
+                map.insert(k, -k);
+            }
+            for (auto k : keys) {
+                if (k % 2) {
+                    map.erase(k);
+                }
+            }
+        });
+    }
+    for (auto& w : writers) {
+        w.join();
+    }
+    REQUIRE(map.size() == std::size_t(nthreads*nkeys/2));
+    for (int k = 0; k < nthreads*nkeys; ++k) {
+        auto found = map.find(k);
+        REQUIRE(bool(found) == (k % 2 == 0));
+        REQUIRE((!found || *found == -k));
+    }
+}
+
+TEST_CASE("[ConcurrentBST] readers see whole updates")
+{
+    using namespace containers;
+
+    struct Pair
+    {
+        std::int64_t a;
+        std::int64_t b;
+    };
+
+    // Writers keep both halves of each value equal, readers check them.
+    const int nkeys = 64;
+    ConcurrentBST<int, Pair> map;
+    for (int k = 0; k < nkeys; ++k) {
+        map.insert(k, Pair{0, 0});
+    }
+    std::atomic<bool> done{false};
+    std::atomic<bool> torn{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; ++t) {
+        threads.emplace_back([&map, &done, t] {
+            std::mt19937 gen(t);
+            for (std::int64_t i = 1; i < 20000; ++i) {
+                int k = int(gen() % nkeys);
+                if (gen() % 4) {
+                    map.insert_or_assign(k, Pair{i, i});
+                }
+                else {
+                    map.erase(k);
+                }
+            }
+            done = true;
+        });
+    }
+    for (int t = 0; t < 2; ++t) {
+        threads.emplace_back([&map, &done, &torn, t] {
+            std::mt19937 gen(10 + t);
+            while (!done) {
+                auto found = map.find(int(gen() % nkeys));
+                if (found && found->a != found->b) {
+                    torn = true;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    REQUIRE(!torn);
+}
+
+TEST_CASE("[ConcurrentBST] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    // A BSTNode set under one reader writer lock is the baseline.
+    struct LockedBST
+    {
+        bool find(int k) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            return containers::find(root.get(), k) != nullptr;
+        }
+
+        void insert(int k)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            containers::insert(root, k, pool);
+        }
+
+        void erase(int k)
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            containers::erase(root, k, pool);
+        }
+
+        mutable std::shared_mutex mutex;
+        std::shared_ptr<BSTNode<int>> root;
+        NodePool<BSTNode<int>> pool;
+    };
+
+    const int nkeys = 1 << 17;
+    const int nops = 1 << 21;
+    std::mt19937 gen(1);
+    std::vector<int> initial(nkeys/2);
+    for (auto& k : initial) {
+        k = int(gen() % nkeys);
+    }
+
+    // run splits nops random operations over nthreads threads, with
+    // reads/100 of them finds and the rest inserts and erases.
+    auto run = [&](auto& map, unsigned nthreads, unsigned reads) {
+        return elapsed_ms([&] {
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < nthreads; ++t) {
+                threads.emplace_back([&map, nthreads, reads, t] {
+                    std::mt19937 gen(t);
+                    std::size_t found = 0;
+                    for (int i = 0; i < nops/int(nthreads); ++i) {
+                        int k = int(gen() % nkeys);
+                        auto op = gen() % 100;
+                        if (op < reads) {
+                            found += map.find(k);
+                        }
+                        else if (op % 2) {
+                            map.insert(k);
+                        }
+                        else {
+                            map.erase(k);
+                        }
+                    }
+                    do_not_optimize(found);
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+        });
+    };
+
+    // ConcurrentMap adapts ConcurrentBST to the operations of run.
+    struct ConcurrentMap
+    {
+        bool find(int k) const
+        {
+            return map.contains(k);
+        }
+
+        void insert(int k)
+        {
+            map.insert(k, k);
+        }
+
+        void erase(int k)
+        {
+            map.erase(k);
+        }
+
+        ConcurrentBST<int, int> map;
+    };
+
+    auto nmax = std::max(4u, std::thread::hardware_concurrency());
+    for (unsigned reads : {50u, 90u, 99u, 100u}) {
+        for (unsigned nthreads = 1; nthreads <= nmax; nthreads *= 2) {
+            LockedBST locked;
+            ConcurrentMap concurrent;
+            for (auto k : initial) {
+                locked.insert(k);
+                concurrent.insert(k);
+            }
+            auto locked_ms = run(locked, nthreads, reads);
+            auto concurrent_ms = run(concurrent, nthreads, reads);
+            MESSAGE(reads << "% finds, " << nthreads << " threads, " << nops << " ops: shared_mutex BSTNode "
+                    << locked_ms << " ms, ConcurrentBST " << concurrent_ms << " ms");
+        }
+    }
+}
@@ -0,0 +1,480 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/bst.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+constexpr std::size_t cache_line = 64;
+
+// CacheAlignedAllocator allocates storage starting at a cache line, so
+// that a block of keys whose offset is a multiple of the line size fills
+// exactly one line.
+template <typename U>
+struct CacheAlignedAllocator
+{
+    using value_type = U;
+
+    CacheAlignedAllocator() = default;
+
+    template <typename V>
+    CacheAlignedAllocator(const CacheAlignedAllocator<V>&) { }
+
+    U* allocate(std::size_t n)
+    {
+        return static_cast<U*>(::operator new(n*sizeof(U), std::align_val_t(cache_line)));
+    }
+
+    void deallocate(U* p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t(cache_line));
+    }
+
+    template <typename V>
+    bool operator==(const CacheAlignedAllocator<V>&) const
+    {
+        return true;
+    }
+
+    template <typename V>
+    bool operator!=(const CacheAlignedAllocator<V>&) const
+    {
+        return false;
+    }
+};
+
+// FrozenBST is a read only set of keys stored as an implicit binary
+// search tree in Eytzinger order: the root at index 1 and the children of
+// the node at index k at 2k and 2k + 1. The top levels, which every
+// search visits, are adjacent at the front of the array, and the search
+// loop has no data dependent branches. The descendants of a node four
+// levels down share one cache line, which is prefetched while the levels
+// above it are compared.
+template <typename T>
+class FrozenBST
+{
+public:
+    FrozenBST() = default;
+
+    // FrozenBST is initialized from sorted values. Duplicates are ignored
+    // and unsorted values throw values_not_sorted_error.
+    explicit FrozenBST(const std::vector<T>& values)
+    {
+        std::vector<T> copy;
+        const auto& sorted = bst_detail::unique_sorted(values, copy);
+        keys.resize(sorted.size() + 1);
+        fill(sorted, 0, 1);
+    }
+
+    // lower_bound returns the first key not less than v or nullptr.
+    const T* lower_bound(const T& v) const
+    {
+        auto base = keys.data();
+        std::size_t n = keys.size();
+        std::size_t k = 1;
+        while (k < n) {
+            prefetch(base, k*prefetch_stride);
+            k = 2*k + (base[k] < v);
+        }
+        // The right turns taken after the last left turn are undone to
+        // get back to the node where it was taken.
+        k >>= __builtin_ctzll(~k) + 1;
+        return k ? base + k : nullptr;
+    }
+
+    // find returns the key equal to v or nullptr if not in tree.
+    const T* find(const T& v) const
+    {
+        auto p = lower_bound(v);
+        return p && !(v < *p) ? p : nullptr;
+    }
+
+    bool contains(const T& v) const
+    {
+        return find(v) != nullptr;
+    }
+
+    // for_each calls visit(key) for the keys in order.
+    template <typename Visit>
+    void for_each(Visit visit) const
+    {
+        for_each(visit, 1);
+    }
+
+    // size returns the number of keys.
+    std::size_t size() const
+    {
+        return keys.empty() ? 0 : keys.size() - 1;
+    }
+
+    // bytes returns the memory used by the keys.
+    std::size_t bytes() const
+    {
+        return keys.size()*sizeof(T);
+    }
+
+private:
+    // prefetch_stride is the number of descendants of a node which fit in
+    // a cache line, a power of two.
+    static constexpr std::size_t prefetch_stride =
+        sizeof(T) >= cache_line ? 1 : sizeof(T) >= 32 ? 2 : sizeof(T) >= 16 ? 4 : sizeof(T) >= 8 ? 8 : 16;
+
+    // prefetch asks for the line holding the key at index k. The address
+    // may be past the end of the keys, which prefetching ignores.
+    static void prefetch(const T* base, std::size_t k)
+    {
+        __builtin_prefetch(reinterpret_cast<const void*>(
+            reinterpret_cast<std::uintptr_t>(base) + k*sizeof(T)));
+    }
+
+    // fill stores sorted values from i in order in the subtree at k and
+    // returns the index of the next value.
+    std::size_t fill(const std::vector<T>& sorted, std::size_t i, std::size_t k)
+    {
+        if (k < keys.size()) {
+            i = fill(sorted, i, 2*k);
+            keys[k] = sorted[i++];
+            i = fill(sorted, i, 2*k + 1);
+        }
+        return i;
+    }
+
+    template <typename Visit>
+    void for_each(Visit& visit, std::size_t k) const
+    {
+        if (k < keys.size()) {
+            for_each(visit, 2*k);
+            visit(keys[k]);
+            for_each(visit, 2*k + 1);
+        }
+    }
+
+    std::vector<T, CacheAlignedAllocator<T>> keys; // keys[0] is unused.
+};
+
+// FrozenKaryBST is a read only set of keys stored as an implicit search
+// tree of B keys per node, where B keys fill one cache line. The B + 1
+// children of node k are nodes k(B + 1) + 1 to k(B + 1) + B + 1. A search
+// reads one line per level, log(B + 1) levels of a binary tree at once,
+// and ranks v within a node by counting the keys less than it, with SSE2
+// compares for 32 bit integers. The last node is padded with copies of
+// the largest key.
+template <typename T>
+class FrozenKaryBST
+{
+public:
+    static_assert(cache_line % sizeof(T) == 0, "keys must divide a cache line");
+
+    static constexpr std::size_t B = cache_line/sizeof(T);
+
+    FrozenKaryBST() = default;
+
+    // FrozenKaryBST is initialized from sorted values. Duplicates are
+    // ignored and unsorted values throw values_not_sorted_error.
+    explicit FrozenKaryBST(const std::vector<T>& values)
+    {
+        std::vector<T> copy;
+        const auto& sorted = bst_detail::unique_sorted(values, copy);
+        n = sorted.size();
+        nodes = (n + B - 1)/B;
+        keys.resize(nodes*B);
+        fill(sorted, 0, 0);
+    }
+
+    // lower_bound returns a key equal to the first key not less than v
+    // or nullptr.
+    const T* lower_bound(const T& v) const
+    {
+        const T* result = nullptr;
+        std::size_t k = 0;
+        while (k < nodes) {
+            auto node = keys.data() + k*B;
+            auto i = rank(node, v);
+            result = i < B ? node + i : result;
+            k = k*(B + 1) + i + 1;
+        }
+        return result;
+    }
+
+    // find returns a key equal to v or nullptr if not in tree.
+    const T* find(const T& v) const
+    {
+        auto p = lower_bound(v);
+        return p && !(v < *p) ? p : nullptr;
+    }
+
+    bool contains(const T& v) const
+    {
+        return find(v) != nullptr;
+    }
+
+    // for_each calls visit(key) for the keys in order.
+    template <typename Visit>
+    void for_each(Visit visit) const
+    {
+        std::size_t i = 0;
+        for_each(visit, 0, i);
+    }
+
+    // size returns the number of keys.
+    std::size_t size() const
+    {
+        return n;
+    }
+
+    // bytes returns the memory used by the keys.
+    std::size_t bytes() const
+    {
+        return keys.size()*sizeof(T);
+    }
+
+private:
+    // rank returns the number of the B keys of node less than v.
+    static std::size_t rank(const T* node, const T& v)
+    {
+#if defined(__SSE2__)
+        if constexpr (std::is_same_v<T, std::int32_t>) {
+            auto x = _mm_set1_epi32(v);
+            unsigned mask = 0;
+            for (std::size_t j = 0; j < B; j += 4) {
+                auto y = _mm_load_si128(reinterpret_cast<const __m128i*>(node + j));
+                mask |= unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x, y)))) << j;
+            }
+            return __builtin_popcount(mask);
+        }
+#endif
+        std::size_t r = 0;
+        for (std::size_t j = 0; j < B; ++j) {
+            r += node[j] < v;
+        }
+        return r;
+    }
+
+    std::size_t child(std::size_t k, std::size_t i) const
+    {
+        return k*(B + 1) + i + 1;
+    }
+
+    std::size_t fill(const std::vector<T>& sorted, std::size_t i, std::size_t k)
+    {
+        if (k < nodes) {
+            for (std::size_t j = 0; j < B; ++j) {
+                i = fill(sorted, i, child(k, j));
+                keys[k*B + j] = i < n ? sorted[i++] : sorted.back();
+            }
+            i = fill(sorted, i, child(k, B));
+        }
+        return i;
+    }
+
+    // for_each visits the keys of the subtree at k in order, counting them
+    // in i to stop before the padding.
+    template <typename Visit>
+    void for_each(Visit& visit, std::size_t k, std::size_t& i) const
+    {
+        if (k < nodes) {
+            for (std::size_t j = 0; j < B; ++j) {
+                for_each(visit, child(k, j), i);
+                if (i < n) {
+                    visit(keys[k*B + j]);
+                    ++i;
+                }
+            }
+            for_each(visit, child(k, B), i);
+        }
+    }
+
+    std::vector<T, CacheAlignedAllocator<T>> keys;
+    std::size_t n = 0;     // Number of keys, without the padding.
+    std::size_t nodes = 0; // Number of nodes of B keys.
+};
+
+// make_frozen_bst returns a frozen bst of the values of a binary search
+// tree of any node type with data, left and right members.
+template <typename Node>
+auto
+make_frozen_bst(const Node* root)
+{
+    using T = std::decay_t<decltype(root->data)>;
+    return FrozenBST<T>(bst_detail::make_vector<T>(root, inorder));
+}
+
+// make_vector returns vector initialized from tree.
+template <typename T>
+std::vector<T>
+make_vector(const FrozenBST<T>& tree)
+{
+    std::vector<T> values;
+    values.reserve(tree.size());
+    tree.for_each([&values](const T& v) { values.push_back(v); });
+    return values;
+}
+
+// make_vector returns vector initialized from tree.
+template <typename T>
+std::vector<T>
+make_vector(const FrozenKaryBST<T>& tree)
+{
+    std::vector<T> values;
+    values.reserve(tree.size());
+    tree.for_each([&values](const T& v) { values.push_back(v); });
+    return values;
+}
+
+}
+
+// check_lower_bound requires tree to agree with std::lower_bound on
+// sorted for every key and the values between them.
+template <typename Tree, typename T>
+void
+check_lower_bound(const Tree& tree, const std::vector<T>& sorted, const std::vector<T>& probes)
+{
+    for (const auto& v : probes) {
+        auto it = std::lower_bound(sorted.begin(), sorted.end(), v);
+        auto p = tree.lower_bound(v);
+        if (it == sorted.end()) {
+            REQUIRE(p == nullptr);
+        }
+        else {
+            REQUIRE(p != nullptr);
+            REQUIRE(*p == *it);
+        }
+        REQUIRE(tree.contains(v) == std::binary_search(sorted.begin(), sorted.end(), v));
+    }
+}
+
+TEST_CASE("[FrozenBST] [FrozenKaryBST]")
+{
+    using namespace containers;
+
+    // Sizes around full trees and whole nodes.
+    std::vector<std::size_t> sizes{0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 33, 255, 256, 271, 272, 273, 1000, 4913, 5000};
+    for (auto n : sizes) {
+        INFO(n);
+        std::vector<std::int32_t> sorted(n);
+        std::vector<std::int32_t> probes;
+        for (std::size_t i = 0; i < n; ++i) {
+            sorted[i] = std::int32_t(3*i) - 1000;
+            probes.push_back(sorted[i]);
+            probes.push_back(sorted[i] + 1);
+        }
+        probes.push_back(-2000);
+        probes.push_back(std::int32_t(3*n));
+
+        FrozenBST<std::int32_t> eytzinger(sorted);
+        FrozenKaryBST<std::int32_t> kary(sorted);
+        REQUIRE(eytzinger.size() == n);
+        REQUIRE(kary.size() == n);
+        REQUIRE(make_vector(eytzinger) == sorted);
+        REQUIRE(make_vector(kary) == sorted);
+        check_lower_bound(eytzinger, sorted, probes);
+        check_lower_bound(kary, sorted, probes);
+    }
+
+    // Keys without the SSE2 path.
+    std::vector<std::int64_t> wide(1000);
+    std::vector<std::int64_t> wide_probes;
+    for (std::size_t i = 0; i < wide.size(); ++i) {
+        wide[i] = std::int64_t(i)*(std::int64_t(1) << 40);
+        wide_probes.push_back(wide[i]);
+        wide_probes.push_back(wide[i] - 1);
+    }
+    check_lower_bound(FrozenBST<std::int64_t>(wide), wide, wide_probes);
+    check_lower_bound(FrozenKaryBST<std::int64_t>(wide), wide, wide_probes);
+
+    std::vector<std::string> words{"ant", "bee", "cat", "dog", "eel", "fox", "gnu"};
+    FrozenBST<std::string> strings(words);
+    check_lower_bound(strings, words, std::vector<std::string>{"a", "ant", "b", "fox", "z"});
+
+    // Duplicates are ignored, unsorted values throw.
+    REQUIRE(make_vector(FrozenBST<int>({1, 1, 2})) == std::vector<int>{1, 2});
+    REQUIRE(make_vector(FrozenKaryBST<int>({1, 1, 2})) == std::vector<int>{1, 2});
+    REQUIRE_THROWS_AS(FrozenBST<int>({2, 1}), values_not_sorted_error);
+    REQUIRE_THROWS_AS(FrozenKaryBST<int>({2, 1}), values_not_sorted_error);
+}
+
+TEST_CASE("[make_frozen_bst]")
+{
+    using namespace containers;
+
+    std::vector<int> values{5, 2, 8, 1, 9, 3, 7};
+    auto root = make_bst(values);
+    auto tree = make_frozen_bst(root.get());
+    REQUIRE(make_vector(tree) == make_vector(root.get()));
+    for (auto v : values) {
+        REQUIRE(*tree.find(v) == find(root.get(), v)->data);
+    }
+    REQUIRE(tree.find(4) == nullptr);
+
+    BSTNode<int>* empty = nullptr;
+    REQUIRE(make_frozen_bst(empty).size() == 0);
+}
+
+TEST_CASE("[FrozenBST] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    std::mt19937 gen(1);
+    const int nqueries = 1 << 22;
+    for (std::size_t n : {std::size_t(1) << 12, std::size_t(1) << 16, std::size_t(1) << 20, std::size_t(1) << 23}) {
+        std::vector<std::int32_t> sorted(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            sorted[i] = std::int32_t(2*i);
+        }
+        std::vector<std::int32_t> queries(nqueries);
+        for (auto& q : queries) {
+            q = std::int32_t(gen() % (2*n));
+        }
+
+        auto root = make_bst_sorted(sorted);
+        FrozenBST<std::int32_t> eytzinger(sorted);
+        FrozenKaryBST<std::int32_t> kary(sorted);
+
+        std::size_t found = 0;
+        auto bst_ms = elapsed_ms([&] {
+            for (auto q : queries) {
+                found += find(root.get(), q) != nullptr;
+            }
+        });
+        auto lower_bound_ms = elapsed_ms([&] {
+            for (auto q : queries) {
+                auto it = std::lower_bound(sorted.begin(), sorted.end(), q);
+                found += it != sorted.end() && *it == q;
+            }
+        });
+        auto eytzinger_ms = elapsed_ms([&] {
+            for (auto q : queries) {
+                found += eytzinger.contains(q);
+            }
+        });
+        auto kary_ms = elapsed_ms([&] {
+            for (auto q : queries) {
+                found += kary.contains(q);
+            }
+        });
+        do_not_optimize(found);
+        MESSAGE(n << " keys, " << nqueries << " finds: BSTNode " << bst_ms
+                << " ms, std::lower_bound " << lower_bound_ms
+                << " ms, FrozenBST " << eytzinger_ms
+                << " ms, FrozenKaryBST " << kary_ms << " ms");
+    }
+}
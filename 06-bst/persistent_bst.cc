@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/avl.h"
+#include "containers/bench.h"
+#include "containers/bst.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// PersistentNode is a node of a PersistentBST. Nodes are never modified
+// once made, so a subtree may be shared by any number of versions.
+template <typename T>
+struct PersistentNode
+{
+    using PersistentNodePtr = std::shared_ptr<const PersistentNode<T>>;
+
+    PersistentNode(PersistentNodePtr left, const T& data, PersistentNodePtr right, int height)
+        : data(data), left(std::move(left)), right(std::move(right)), height(height)
+    { }
+
+    T data;
+    PersistentNodePtr left;
+    PersistentNodePtr right;
+    int height; // Height of the subtree, 0 for a leaf.
+};
+
+// PersistentBST is an immutable binary search tree. insert and erase
+// return a new version of the tree, copying only the nodes on the path to
+// the value and sharing every other subtree with the version they were
+// called on, which is left unchanged. Taking a snapshot is copying one
+// shared_ptr, and each copy may be read from one thread while another
+// makes new versions from its own copy. When Balanced, the tree is kept
+// AVL balanced, so an update makes O(log n) nodes.
+template <typename T, bool Balanced = true>
+class PersistentBST
+{
+public:
+    using Node = PersistentNode<T>;
+    using NodePtr = typename Node::PersistentNodePtr;
+
+    PersistentBST() = default;
+
+    // insert returns the tree with v added.
+    PersistentBST insert(const T& v) const
+    {
+        std::vector<const Node*> path;
+        auto node = root_.get();
+        while (node) {
+            if (v < node->data) {
+                path.push_back(node);
+                node = node->left.get();
+            }
+            else if (v > node->data) {
+                path.push_back(node);
+                node = node->right.get();
+            }
+            else {
+                return *this; // Ignore dupes.
+            }
+        }
+        return PersistentBST(copy_path(path, v, make(nullptr, v, nullptr)), size_ + 1);
+    }
+
+    // erase returns the tree with v removed. A node with two children is
+    // replaced by a copy of its successor.
+    PersistentBST erase(const T& v) const
+    {
+        std::vector<const Node*> path;
+        auto node = root_.get();
+        while (node && (v < node->data || v > node->data)) {
+            path.push_back(node);
+            node = v < node->data ? node->left.get() : node->right.get();
+        }
+        if (!node) {
+            return *this;
+        }
+
+        NodePtr subtree;
+        if (!node->left) {
+            subtree = node->right;
+        }
+        else if (!node->right) {
+            subtree = node->left;
+        }
+        else {
+            std::vector<const Node*> min_path;
+            auto min = node->right.get();
+            while (min->left) {
+                min_path.push_back(min);
+                min = min->left.get();
+            }
+            auto right = copy_path(min_path, min->data, min->right);
+            subtree = balance(node->left, min->data, std::move(right));
+        }
+        return PersistentBST(copy_path(path, v, std::move(subtree)), size_ - 1);
+    }
+
+    // find returns the node containing v or nullptr if not in tree.
+    const Node* find(const T& v) const
+    {
+        return bst_detail::find(root_.get(), v);
+    }
+
+    bool contains(const T& v) const
+    {
+        return find(v) != nullptr;
+    }
+
+    const Node* root() const
+    {
+        return root_.get();
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+private:
+    PersistentBST(NodePtr root, std::size_t size) : root_(std::move(root)), size_(size) { }
+
+    static int height(const NodePtr& node)
+    {
+        return node ? node->height : -1;
+    }
+
+    static NodePtr make(NodePtr left, const T& v, NodePtr right)
+    {
+        auto h = 1 + std::max(height(left), height(right));
+        return std::make_shared<const Node>(std::move(left), v, std::move(right), h);
+    }
+
+    // balance returns a new node holding v over left and right, whose
+    // heights differ by at most two, rotating copies of the taller side
+    // when they differ by two.
+    static NodePtr balance(NodePtr left, const T& v, NodePtr right)
+    {
+        if constexpr (Balanced) {
+            auto hl = height(left);
+            auto hr = height(right);
+            if (hl > hr + 1) {
+                if (height(left->left) >= height(left->right)) {
+                    return make(left->left, left->data, make(left->right, v, std::move(right)));
+                }
+                auto lr = left->right.get();
+                return make(make(left->left, left->data, lr->left), lr->data,
+                            make(lr->right, v, std::move(right)));
+            }
+            if (hr > hl + 1) {
+                if (height(right->right) >= height(right->left)) {
+                    return make(make(std::move(left), v, right->left), right->data, right->right);
+                }
+                auto rl = right->left.get();
+                return make(make(std::move(left), v, rl->left), rl->data,
+                            make(rl->right, right->data, right->right));
+            }
+        }
+        return make(std::move(left), v, std::move(right));
+    }
+
+    // copy_path returns a copy of the nodes on path, from the root down,
+    // with subtree in place of the child of the last one on the side of v.
+    static NodePtr copy_path(const std::vector<const Node*>& path, const T& v, NodePtr subtree)
+    {
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            auto node = *it;
+            if (v < node->data) {
+                subtree = balance(std::move(subtree), node->data, node->right);
+            }
+            else {
+                subtree = balance(node->left, node->data, std::move(subtree));
+            }
+        }
+        return subtree;
+    }
+
+    NodePtr root_;
+    std::size_t size_ = 0;
+};
+
+// make_persistent_bst returns persistent bst initialized from container of values.
+template <typename T, bool Balanced = true>
+PersistentBST<T, Balanced>
+make_persistent_bst(const std::vector<T>& values)
+{
+    PersistentBST<T, Balanced> tree;
+    for (const auto& v : values) {
+        tree = tree.insert(v);
+    }
+    return tree;
+}
+
+// make_vector returns vector initialized from tree.
+template <typename T>
+std::vector<T>
+make_vector(const PersistentNode<T>* root, const Order& order=inorder)
+{
+    return bst_detail::make_vector<T>(root, order);
+}
+
+// tree_height returns the height of the tree.
+template <typename T>
+std::size_t
+tree_height(const PersistentNode<T>* root)
+{
+    return root ? root->height : 0;
+}
+
+}
+
+// is_balanced returns true when the cached heights are correct, the tree
+// is ordered and, if balanced is set, every node is AVL balanced.
+template <typename T>
+bool
+is_balanced(const containers::PersistentNode<T>* node, bool balanced,
+            const T* lo = nullptr, const T* hi = nullptr)
+{
+    if (!node) {
+        return true;
+    }
+    if ((lo && !(*lo < node->data)) || (hi && !(node->data < *hi))) {
+        return false;
+    }
+    int lh = node->left ? node->left->height : -1;
+    int rh = node->right ? node->right->height : -1;
+    return node->height == 1 + std::max(lh, rh) && (!balanced || (lh - rh <= 1 && rh - lh <= 1))
+        && is_balanced(node->left.get(), balanced, lo, &node->data)
+        && is_balanced(node->right.get(), balanced, &node->data, hi);
+}
+
+// new_nodes returns the number of nodes of tree which are not in base.
+template <typename T>
+std::size_t
+new_nodes(const containers::PersistentNode<T>* tree, const containers::PersistentNode<T>* base)
+{
+    std::unordered_set<const containers::PersistentNode<T>*> old;
+    containers::traverse(base, containers::preorder, [&](auto node) { old.insert(node); });
+    std::size_t n = 0;
+    containers::traverse(tree, containers::preorder, [&](auto node) { n += !old.count(node); });
+    return n;
+}
+
+TEST_CASE("[PersistentBST]")
+{
+    using namespace containers;
+
+    struct test_case
+    {
+        std::string name;
+        std::vector<int> values;
+        std::vector<int> balanced;   // Preorder of the balanced tree.
+        std::vector<int> unbalanced; // Preorder of the unbalanced tree.
+    };
+
+    std::vector<test_case> test_cases{
+        {"Empty tree.", {}, {}, {}},
+        {"Only root.", {1}, {1}, {1}},
+        {"Ignore dupes.", {1, 1}, {1}, {1}},
+        {"Ascending.", {1, 2, 3}, {2, 1, 3}, {1, 2, 3}},
+        {"Descending.", {3, 2, 1}, {2, 1, 3}, {3, 2, 1}},
+        {"Left right.", {3, 1, 2}, {2, 1, 3}, {3, 1, 2}},
+        {"Right left.", {1, 3, 2}, {2, 1, 3}, {1, 3, 2}},
+        {"Full.", {4, 2, 6, 1, 3, 5, 7}, {4, 2, 1, 3, 6, 5, 7}, {4, 2, 1, 3, 6, 5, 7}},
+    };
+
+    for (const auto& c : test_cases) {
+        INFO(c.name);
+        auto balanced = make_persistent_bst(c.values);
+        auto unbalanced = make_persistent_bst<int, false>(c.values);
+        REQUIRE(make_vector(balanced.root(), preorder) == c.balanced);
+        REQUIRE(make_vector(unbalanced.root(), preorder) == c.unbalanced);
+        REQUIRE(balanced.size() == c.balanced.size());
+        REQUIRE(unbalanced.size() == c.unbalanced.size());
+    }
+}
+
+TEST_CASE("[PersistentBST] versions")
+{
+    using namespace containers;
+
+    // Every version keeps its values after later updates.
+    std::mt19937 gen(5);
+    std::vector<PersistentBST<int>> versions(1);
+    std::vector<PersistentBST<int, false>> unbalanced_versions(1);
+    std::vector<std::set<int>> expected(1);
+    for (int i = 0; i < 2000; ++i) {
+        int v = int(gen() % 300);
+        auto s = expected.back();
+        if (gen() % 3) {
+            versions.push_back(versions.back().insert(v));
+            unbalanced_versions.push_back(unbalanced_versions.back().insert(v));
+            s.insert(v);
+        }
+        else {
+            versions.push_back(versions.back().erase(v));
+            unbalanced_versions.push_back(unbalanced_versions.back().erase(v));
+            s.erase(v);
+        }
+        expected.push_back(std::move(s));
+    }
+    for (std::size_t i = 0; i < versions.size(); ++i) {
+        std::vector<int> values(expected[i].begin(), expected[i].end());
+        REQUIRE(make_vector(versions[i].root()) == values);
+        REQUIRE(make_vector(unbalanced_versions[i].root()) == values);
+        REQUIRE(versions[i].size() == values.size());
+        REQUIRE(unbalanced_versions[i].size() == values.size());
+        REQUIRE(is_balanced(versions[i].root(), true));
+        REQUIRE(is_balanced(unbalanced_versions[i].root(), false));
+    }
+
+    // Updates which change nothing return the same tree.
+    auto& last = versions.back();
+    REQUIRE(last.insert(*expected.back().begin()).root() == last.root());
+    REQUIRE(last.erase(-1).root() == last.root());
+    REQUIRE(last.contains(*expected.back().begin()));
+    REQUIRE(!last.contains(-1));
+}
+
+TEST_CASE("[PersistentBST] shares untouched subtrees")
+{
+    using namespace containers;
+
+    std::vector<int> values(1 << 12);
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        values[i] = 2*int(i);
+    }
+    std::mt19937 gen(7);
+    std::shuffle(values.begin(), values.end(), gen);
+    auto tree = make_persistent_bst(values);
+    auto h = tree_height(tree.root());
+    REQUIRE(h <= 14);
+
+    // Insert copies the path and rotates at most once.
+    for (int i = 0; i < 100; ++i) {
+        int v = 2*int(gen() % values.size()) + 1;
+        auto next = tree.insert(v);
+        REQUIRE(new_nodes(next.root(), tree.root()) <= h + 4);
+        tree = next;
+    }
+
+    // Erase copies the paths to the value and its successor, and may
+    // rotate at every level.
+    for (int i = 0; i < 100; ++i) {
+        int v = values[gen() % values.size()];
+        auto next = tree.erase(v);
+        REQUIRE(new_nodes(next.root(), tree.root()) <= 3*(h + 2));
+        tree = next;
+    }
+    REQUIRE(is_balanced(tree.root(), true));
+}
+
+TEST_CASE("[PersistentBST] snapshot read while writing")
+{
+    using namespace containers;
+
+    std::vector<int> values(1 << 14);
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        values[i] = int(i);
+    }
+    auto tree = make_persistent_bst(values);
+
+    // The reader holds its own copy, so the writer needs no lock.
+    auto snapshot = tree;
+    std::thread writer([tree]() mutable {
+        for (int i = 0; i < (1 << 14); i += 2) {
+            tree = tree.erase(i);
+            tree = tree.insert(-i - 1);
+        }
+    });
+    bool ok = true;
+    for (int pass = 0; pass < 8; ++pass) {
+        ok = ok && make_vector(snapshot.root()) == values;
+    }
+    writer.join();
+    REQUIRE(ok);
+}
+
+TEST_CASE("[PersistentBST] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 20;
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = 2*i;
+    }
+    std::mt19937 gen(1);
+    std::shuffle(values.begin(), values.end(), gen);
+
+    PersistentBST<int> tree;
+    MESSAGE("PersistentBST insert " << n << ": " << elapsed_ms([&] {
+        tree = make_persistent_bst(values);
+    }) << " ms");
+    std::shared_ptr<AVLNode<int>> avl;
+    MESSAGE("AVLNode insert " << n << ": " << elapsed_ms([&] {
+        avl = make_avl(values);
+    }) << " ms");
+
+    // Keep a snapshot every 10000 updates, by copying the root or, for the
+    // mutable tree, by copying the whole tree.
+    const int updates = 100000;
+    std::vector<int> keys(updates);
+    for (auto& k : keys) {
+        k = 2*int(gen() % n);
+    }
+    std::vector<PersistentBST<int>> versions;
+    MESSAGE("PersistentBST erase+insert with snapshots: " << elapsed_ms([&] {
+        for (int i = 0; i < updates; ++i) {
+            tree = tree.erase(keys[i]).insert(keys[i] + 1);
+            if (i % 10000 == 0) {
+                versions.push_back(tree);
+            }
+        }
+    }) << " ms");
+    std::vector<std::shared_ptr<BSTNode<int>>> copies;
+    MESSAGE("AVLNode erase+insert with copies: " << elapsed_ms([&] {
+        for (int i = 0; i < updates; ++i) {
+            erase(avl, keys[i]);
+            insert(avl, keys[i] + 1);
+            if (i % 10000 == 0) {
+                copies.push_back(make_bst_sorted(make_vector(avl.get())));
+            }
+        }
+    }) << " ms");
+
+    int found = 0;
+    MESSAGE("PersistentBST find " << updates << ": " << elapsed_ms([&] {
+        for (auto k : keys) {
+            found += tree.contains(k + 1);
+        }
+    }) << " ms");
+    MESSAGE("AVLNode find " << updates << ": " << elapsed_ms([&] {
+        for (auto k : keys) {
+            found += find(avl.get(), k + 1) != nullptr;
+        }
+    }) << " ms");
+    do_not_optimize(found);
+}
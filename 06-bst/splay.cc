@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/avl.h"
+#include "containers/bench.h"
+#include "containers/bst.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// splay moves the node containing v, or the last node on the search path
+// for v, to the root. The tree is splayed top down: nodes left of the
+// search path are linked into a left tree and nodes right of it into a
+// right tree on the way down, rotating pairs of nodes on a straight path,
+// then the two trees become the subtrees of the new root. A sequence of
+// m splays on a tree of n nodes costs O((m + n) log n), and frequently
+// accessed values stay near the root.
+template <typename T>
+void
+splay(std::shared_ptr<BSTNode<T>>& root, const T& v)
+{
+    if (!root) {
+        return;
+    }
+    std::shared_ptr<BSTNode<T>> left_tree;
+    std::shared_ptr<BSTNode<T>> right_tree;
+    auto left_max = &left_tree;   // Right child slot of the largest node of the left tree.
+    auto right_min = &right_tree; // Left child slot of the smallest node of the right tree.
+    auto t = std::move(root);
+    for (;;) {
+        if (v < t->data) {
+            if (!t->left) {
+                break;
+            }
+            if (v < t->left->data) {
+                auto l = std::move(t->left); // Rotate right.
+                t->left = std::move(l->right);
+                l->right = std::move(t);
+                t = std::move(l);
+                if (!t->left) {
+                    break;
+                }
+            }
+            auto l = std::move(t->left); // Link t into the right tree.
+            *right_min = std::move(t);
+            right_min = &(*right_min)->left;
+            t = std::move(l);
+        }
+        else if (v > t->data) {
+            if (!t->right) {
+                break;
+            }
+            if (v > t->right->data) {
+                auto r = std::move(t->right); // Rotate left.
+                t->right = std::move(r->left);
+                r->left = std::move(t);
+                t = std::move(r);
+                if (!t->right) {
+                    break;
+                }
+            }
+            auto r = std::move(t->right); // Link t into the left tree.
+            *left_max = std::move(t);
+            left_max = &(*left_max)->right;
+            t = std::move(r);
+        }
+        else {
+            break;
+        }
+    }
+    *left_max = std::move(t->left);
+    *right_min = std::move(t->right);
+    t->left = std::move(left_tree);
+    t->right = std::move(right_tree);
+    root = std::move(t);
+}
+
+// splay_find returns the node containing v or nullptr if not in tree,
+// splaying the tree at root, so the node found becomes the root.
+template <typename T>
+const BSTNode<T>*
+splay_find(std::shared_ptr<BSTNode<T>>& root, const T& v)
+{
+    splay(root, v);
+    return root && !(root->data < v) && !(v < root->data) ? root.get() : nullptr;
+}
+
+// splay_insert adds v to the tree at root as its new root. Returns the
+// node containing v.
+template <typename T>
+BSTNode<T>*
+splay_insert(std::shared_ptr<BSTNode<T>>& root, const T& v)
+{
+    splay(root, v);
+    if (!root) {
+        root = std::make_shared<BSTNode<T>>(v);
+    }
+    else if (v < root->data) {
+        auto node = std::make_shared<BSTNode<T>>(v);
+        node->left = std::move(root->left);
+        node->right = std::move(root);
+        root = std::move(node);
+    }
+    else if (v > root->data) {
+        auto node = std::make_shared<BSTNode<T>>(v);
+        node->right = std::move(root->right);
+        node->left = std::move(root);
+        root = std::move(node);
+    }
+    return root.get(); // Ignore dupes.
+}
+
+// splay_erase removes v from the tree at root and returns true if it was
+// in the tree. The largest value less than v becomes the root.
+template <typename T>
+bool
+splay_erase(std::shared_ptr<BSTNode<T>>& root, const T& v)
+{
+    if (!splay_find(root, v)) {
+        return false;
+    }
+    auto right = std::move(root->right);
+    auto left = std::move(root->left);
+    root = std::move(left);
+    if (root) {
+        splay(root, v); // The largest value of the left subtree has no right child.
+        root->right = std::move(right);
+    }
+    else {
+        root = std::move(right);
+    }
+    return true;
+}
+
+}
+
+// zipf_keys returns count draws from keys where the kth most frequent key
+// is drawn with probability proportional to 1/k^s.
+std::vector<int>
+zipf_keys(const std::vector<int>& keys, double s, std::size_t count, std::mt19937& gen)
+{
+    std::vector<double> weights(keys.size());
+    for (std::size_t k = 0; k < weights.size(); ++k) {
+        weights[k] = 1.0/std::pow(double(k + 1), s);
+    }
+    std::discrete_distribution<std::size_t> rank(weights.begin(), weights.end());
+    std::vector<int> draws(count);
+    for (auto& d : draws) {
+        d = keys[rank(gen)];
+    }
+    return draws;
+}
+
+TEST_CASE("[splay]")
+{
+    using namespace containers;
+
+    struct test_case
+    {
+        std::string name;
+        std::vector<int> values;
+        int splay;
+        std::vector<int> preorder;
+    };
+
+    std::vector<test_case> test_cases{
+        {"Empty tree.", {}, 1, {}},
+        {"Root.", {2, 1, 3}, 2, {2, 1, 3}},
+        {"Zig.", {2, 1, 3}, 1, {1, 2, 3}},
+        {"Zag.", {2, 1, 3}, 3, {3, 2, 1}},
+        {"Zig zig.", {3, 2, 1}, 1, {1, 2, 3}},
+        {"Zag zag.", {1, 2, 3}, 3, {3, 2, 1}},
+        {"Zig zag.", {3, 1, 2}, 2, {2, 1, 3}},
+        {"Zag zig.", {1, 3, 2}, 2, {2, 1, 3}},
+        {"Missing value.", {4, 2, 6}, 5, {6, 4, 2}},
+        {"Deep.", {7, 6, 5, 4, 3, 2, 1}, 1, {1, 6, 4, 2, 3, 5, 7}},
+    };
+
+    for (const auto& c : test_cases) {
+        INFO(c.name);
+        auto root = make_bst(c.values);
+        splay(root, c.splay);
+        REQUIRE(make_vector(root.get(), Order::preorder) == c.preorder);
+        auto sorted = c.values;
+        std::sort(sorted.begin(), sorted.end());
+        REQUIRE(make_vector(root.get()) == sorted);
+    }
+}
+
+TEST_CASE("[splay_insert] [splay_find] [splay_erase]")
+{
+    using namespace containers;
+
+    std::shared_ptr<BSTNode<int>> root;
+    std::set<int> expected;
+    std::mt19937 gen(3);
+    for (int i = 0; i < 20000; ++i) {
+        int v = int(gen() % 1000);
+        switch (gen() % 3) {
+        case 0:
+            REQUIRE(splay_insert(root, v)->data == v);
+            REQUIRE(root->data == v);
+            expected.insert(v);
+            break;
+        case 1:
+            REQUIRE(bool(splay_find(root, v)) == bool(expected.count(v)));
+            break;
+        default:
+            REQUIRE(splay_erase(root, v) == bool(expected.erase(v)));
+            break;
+        }
+    }
+    REQUIRE(make_vector(root.get()) == std::vector<int>(expected.begin(), expected.end()));
+
+    // A found value is moved to the root.
+    auto v = *expected.rbegin();
+    REQUIRE(splay_find(root, v) == root.get());
+    REQUIRE(root->right == nullptr);
+}
+
+TEST_CASE("[splay_insert] degenerate tree")
+{
+    using namespace containers;
+
+    // Ascending inserts leave a left path as tall as the tree, which must
+    // be destroyed without recursing once per level.
+    const int n = 1 << 20;
+    std::shared_ptr<BSTNode<int>> root;
+    for (int i = 0; i < n; ++i) {
+        splay_insert(root, i);
+    }
+    REQUIRE(root->data == n - 1);
+    REQUIRE(root->right == nullptr);
+    root.reset();
+    REQUIRE(root == nullptr);
+}
+
+TEST_CASE("[splay_find] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    const int n = 1 << 20;
+    const std::size_t nqueries = 1 << 22;
+    std::vector<int> values(n);
+    std::iota(values.begin(), values.end(), 0);
+    std::mt19937 gen(1);
+    std::shuffle(values.begin(), values.end(), gen);
+
+    auto bst = make_bst(values);
+    auto avl = make_avl(values);
+    auto splay_tree = make_bst(values);
+
+    // Frequency rank is independent of key order, so hot keys are spread
+    // over the whole tree.
+    for (double s : {0.0, 0.8, 1.0, 1.2, 1.5}) {
+        auto queries = zipf_keys(values, s, nqueries, gen);
+        std::size_t found = 0;
+        auto bst_ms = elapsed_ms([&] {
+            for (auto q : queries) {
+                found += find(bst.get(), q) != nullptr;
+            }
+        });
+        auto avl_ms = elapsed_ms([&] {
+            for (auto q : queries) {
+                found += find(avl.get(), q) != nullptr;
+            }
+        });
+        auto splay_ms = elapsed_ms([&] {
+            for (auto q : queries) {
+                found += splay_find(splay_tree, q) != nullptr;
+            }
+        });
+        do_not_optimize(found);
+        MESSAGE("zipf s=" << s << ", " << nqueries << " finds: BSTNode " << bst_ms
+                << " ms, AVLNode " << avl_ms << " ms, splay " << splay_ms << " ms");
+    }
+}
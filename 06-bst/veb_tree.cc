@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+
+#include "containers/bench.h"
+#include "containers/bst.h"
+#include "containers/tree.h"
+
+#if __has_include("containers/print.h")
+#   include "containers/print.h"
+#endif
+
+namespace containers
+{
+
+// ArrayTree is a static binary tree stored in a single vector. Children
+// are found by index instead of by pointer, so the order of the nodes in
+// the vector decides which nodes share a cache line or page. The root is
+// always at index 0.
+template <typename T>
+class ArrayTree
+{
+public:
+    using index_type = std::uint32_t;
+
+    // npos is the index returned for a node which does not exist.
+    static constexpr index_type npos = index_type(-1);
+
+    struct Node
+    {
+        T data;
+        index_type left = npos;
+        index_type right = npos;
+    };
+
+    ArrayTree() = default;
+
+    explicit ArrayTree(std::vector<Node> nodes) : nodes(std::move(nodes)) { }
+
+    // root returns the index of the root or npos for an empty tree.
+    index_type root() const
+    {
+        return nodes.empty() ? npos : 0;
+    }
+
+    // left returns the index of the left child of node i or npos.
+    index_type left(index_type i) const
+    {
+        return nodes[i].left;
+    }
+
+    // right returns the index of the right child of node i or npos.
+    index_type right(index_type i) const
+    {
+        return nodes[i].right;
+    }
+
+    const T& operator[](index_type i) const
+    {
+        return nodes[i].data;
+    }
+
+    // size returns the number of nodes in the tree.
+    std::size_t size() const
+    {
+        return nodes.size();
+    }
+
+    // bytes returns the memory used by the nodes.
+    std::size_t bytes() const
+    {
+        return nodes.size()*sizeof(Node);
+    }
+
+private:
+    std::vector<Node> nodes;
+};
+
+namespace veb_detail
+{
+
+// levels returns the number of levels in the tree at root.
+template <typename Node>
+std::size_t
+levels(const Node* root)
+{
+    std::size_t n = 0;
+    std::vector<std::pair<const Node*, std::size_t>> stack;
+    if (root) {
+        stack.emplace_back(root, 1);
+    }
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        n = std::max(n, depth);
+        if (node->right) {
+            stack.emplace_back(node->right.get(), depth + 1);
+        }
+        if (node->left) {
+            stack.emplace_back(node->left.get(), depth + 1);
+        }
+    }
+    return n;
+}
+
+// layout appends the nodes of the subtree at root which are less than
+// levels deep to order in van Emde Boas order: the top half of the
+// levels first, then each subtree hanging below it from left to right,
+// each laid out the same way. The recursion halves levels at each step.
+template <typename Node>
+void
+layout(const Node* root, std::size_t levels, std::vector<const Node*>& order)
+{
+    if (levels == 1) {
+        order.push_back(root);
+        return;
+    }
+    auto top = levels/2;
+    layout(root, top, order);
+
+    // The bottom subtrees are rooted at depth top, found left to right.
+    std::vector<const Node*> bottom;
+    std::vector<std::pair<const Node*, std::size_t>> stack{{root, 0}};
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        if (depth == top) {
+            bottom.push_back(node);
+            continue;
+        }
+        if (node->right) {
+            stack.emplace_back(node->right.get(), depth + 1);
+        }
+        if (node->left) {
+            stack.emplace_back(node->left.get(), depth + 1);
+        }
+    }
+    for (auto node : bottom) {
+        layout(node, levels - top, order);
+    }
+}
+
+}
+
+// make_veb_tree returns an ArrayTree with the shape and values of the
+// tree at root, a TreeNode or BSTNode, in van Emde Boas order. Any
+// root-to-leaf walk then touches O(log_B n) blocks of B nodes for every
+// block size B, without tuning for a particular cache.
+template <typename Node>
+auto
+make_veb_tree(const Node* root) -> ArrayTree<std::decay_t<decltype(root->data)>>
+{
+    using Tree = ArrayTree<std::decay_t<decltype(root->data)>>;
+    using index_type = typename Tree::index_type;
+
+    std::vector<const Node*> order;
+    if (root) {
+        veb_detail::layout(root, veb_detail::levels(root), order);
+    }
+
+    std::unordered_map<const Node*, index_type> index;
+    index.reserve(order.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        index.emplace(order[i], index_type(i));
+    }
+    std::vector<typename Tree::Node> nodes(order.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        nodes[i].data = order[i]->data;
+        if (order[i]->left) {
+            nodes[i].left = index[order[i]->left.get()];
+        }
+        if (order[i]->right) {
+            nodes[i].right = index[order[i]->right.get()];
+        }
+    }
+    return Tree(std::move(nodes));
+}
+
+// make_bfs_tree returns an ArrayTree with the shape and values of the
+// tree at root in level order.
+template <typename Node>
+auto
+make_bfs_tree(const Node* root) -> ArrayTree<std::decay_t<decltype(root->data)>>
+{
+    using Tree = ArrayTree<std::decay_t<decltype(root->data)>>;
+    using index_type = typename Tree::index_type;
+
+    std::vector<typename Tree::Node> nodes;
+    std::queue<const Node*> queue;
+    if (root) {
+        queue.push(root);
+    }
+    while (!queue.empty()) {
+        auto node = queue.front();
+        queue.pop();
+        // Children are numbered in the order they are queued.
+        typename Tree::Node n{node->data};
+        auto next = index_type(nodes.size() + queue.size() + 1);
+        if (node->left) {
+            n.left = next++;
+            queue.push(node->left.get());
+        }
+        if (node->right) {
+            n.right = next++;
+            queue.push(node->right.get());
+        }
+        nodes.push_back(n);
+    }
+    return Tree(std::move(nodes));
+}
+
+// find returns the index of the node containing v or npos if not in tree.
+template <typename T>
+typename ArrayTree<T>::index_type
+find(const ArrayTree<T>& tree, const T& v)
+{
+    auto i = tree.root();
+    while (i != ArrayTree<T>::npos) {
+        if (v < tree[i]) {
+            i = tree.left(i);
+        }
+        else if (v > tree[i]) {
+            i = tree.right(i);
+        }
+        else {
+            break;
+        }
+    }
+    return i;
+}
+
+// make_vector returns vector initialized from an inorder traversal.
+template <typename T>
+std::vector<T>
+make_vector(const ArrayTree<T>& tree)
+{
+    std::vector<T> values;
+    std::vector<typename ArrayTree<T>::index_type> stack;
+    auto i = tree.root();
+    while (i != ArrayTree<T>::npos || !stack.empty()) {
+        while (i != ArrayTree<T>::npos) {
+            stack.push_back(i);
+            i = tree.left(i);
+        }
+        i = stack.back();
+        stack.pop_back();
+        values.push_back(tree[i]);
+        i = tree.right(i);
+    }
+    return values;
+}
+
+}
+
+TEST_CASE("[make_veb_tree]")
+{
+    using namespace containers;
+
+    struct test_case
+    {
+        std::string name;
+        std::vector<int> values;
+        std::vector<int> veb;
+        std::vector<int> bfs;
+    };
+
+    std::vector<test_case> test_cases{
+        {
+            "Empty tree.",
+            {},
+            {},
+            {},
+        },
+        {
+            "1 node.",
+            {1},
+            {1},
+            {1},
+        },
+        {
+            "3 node, ascending.",
+            {1, 2, 3},
+            {1, 2, 3},
+            {1, 2, 3},
+        },
+        {
+            "7 node, balanced.",
+            {4, 2, 1, 3, 6, 5, 7},
+            {4, 2, 1, 3, 6, 5, 7},
+            {4, 2, 6, 1, 3, 5, 7},
+        },
+        {
+            "15 node, balanced.",
+            {8, 4, 12, 2, 6, 10, 14, 1, 3, 5, 7, 9, 11, 13, 15},
+            {8, 4, 12, 2, 1, 3, 6, 5, 7, 10, 9, 11, 14, 13, 15},
+            {8, 4, 12, 2, 6, 10, 14, 1, 3, 5, 7, 9, 11, 13, 15},
+        },
+    };
+
+    for (const auto& c : test_cases) {
+        INFO(c.name);
+        auto root = make_bst(c.values);
+        auto veb = make_veb_tree(root.get());
+        auto bfs = make_bfs_tree(root.get());
+        std::vector<int> veb_order;
+        std::vector<int> bfs_order;
+        for (std::size_t i = 0; i < veb.size(); ++i) {
+            veb_order.push_back(veb[i]);
+            bfs_order.push_back(bfs[i]);
+        }
+        REQUIRE(veb_order == c.veb);
+        REQUIRE(bfs_order == c.bfs);
+        REQUIRE(make_vector(veb) == make_vector(root.get()));
+        REQUIRE(make_vector(bfs) == make_vector(root.get()));
+    }
+}
+
+TEST_CASE("[make_veb_tree] shapes")
+{
+    using namespace containers;
+
+    std::mt19937 gen(7);
+    for (int n : {2, 5, 100, 1000}) {
+        std::vector<int> values(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = 2*i;
+        }
+        std::shuffle(values.begin(), values.end(), gen);
+        auto root = make_bst(values);
+        auto veb = make_veb_tree(root.get());
+        REQUIRE(veb.size() == values.size());
+        REQUIRE(make_vector(veb) == make_vector(root.get()));
+        for (int v = -1; v <= 2*n; ++v) {
+            auto i = find(veb, v);
+            if (v % 2 == 0 && v < 2*n) {
+                REQUIRE(i != ArrayTree<int>::npos);
+                REQUIRE(veb[i] == v);
+            }
+            else {
+                REQUIRE(i == ArrayTree<int>::npos);
+            }
+        }
+    }
+
+    // A skewed tree, too deep to lay out by recursing once per level.
+    std::vector<int> sorted(100000);
+    for (int i = 0; i < int(sorted.size()); ++i) {
+        sorted[i] = i;
+    }
+    auto chain = std::make_shared<TreeNode<int>>(0);
+    auto node = chain.get();
+    for (int i = 1; i < int(sorted.size()); ++i) {
+        node = node->insert_right(i);
+    }
+    auto veb = make_veb_tree(chain.get());
+    REQUIRE(make_vector(veb) == sorted);
+    REQUIRE(find(veb, 99999) == 99999);
+
+    // Any binary tree keeps its shape.
+    auto tree = make_tree(std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+    auto expected = make_vector(tree.get());
+    auto bfs = make_bfs_tree(tree.get());
+    std::vector<int> level;
+    for (std::size_t i = 0; i < bfs.size(); ++i) {
+        level.push_back(bfs[i]);
+    }
+    REQUIRE(level == expected);
+    veb = make_veb_tree(tree.get());
+    REQUIRE(veb[0] == 1);
+    REQUIRE(veb[veb.left(0)] == 2);
+    REQUIRE(veb[veb.right(0)] == 3);
+    REQUIRE(veb[veb.left(veb.left(veb.left(0)))] == 8);
+}
+
+TEST_CASE("[make_veb_tree] benchmark" * doctest::test_suite("bench") * doctest::skip())
+{
+    using namespace containers;
+
+    // 4M nodes take 48MB as an ArrayTree, beyond a typical last level cache.
+    const int n = 1 << 22;
+    std::vector<int> values(n);
+    for (int i = 0; i < n; ++i) {
+        values[i] = i;
+    }
+    std::mt19937 gen(1);
+    std::shuffle(values.begin(), values.end(), gen);
+    auto root = make_bst(values);
+
+    ArrayTree<int> veb;
+    ArrayTree<int> bfs;
+    MESSAGE("make_veb_tree: " << elapsed_ms([&] { veb = make_veb_tree(root.get()); }) << " ms");
+    MESSAGE("make_bfs_tree: " << elapsed_ms([&] { bfs = make_bfs_tree(root.get()); }) << " ms");
+
+    std::vector<int> keys(1000000);
+    for (auto& k : keys) {
+        k = int(gen() % n);
+    }
+    std::size_t found = 0;
+    MESSAGE("find BSTNode: " << elapsed_ms([&] {
+        for (auto k : keys) {
+            found += find(root.get(), k) != nullptr;
+        }
+    }) << " ms");
+    MESSAGE("find bfs ArrayTree: " << elapsed_ms([&] {
+        for (auto k : keys) {
+            found += find(bfs, k) != ArrayTree<int>::npos;
+        }
+    }) << " ms");
+    MESSAGE("find veb ArrayTree: " << elapsed_ms([&] {
+        for (auto k : keys) {
+            found += find(veb, k) != ArrayTree<int>::npos;
+        }
+    }) << " ms");
+    REQUIRE(found == 3*keys.size());
+}
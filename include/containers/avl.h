@@ -0,0 +1,554 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "containers/bst.h"
+#include "containers/work_stealing.h"
+
+namespace containers
+{
+
+namespace avl_detail
+{
+
+// SubtreeSize holds the number of nodes in the subtree of a counted node
+// and takes no space in other nodes.
+template <bool Counted>
+struct SubtreeSize
+{ };
+
+template <>
+struct SubtreeSize<true>
+{
+    std::size_t size = 1;
+};
+
+}
+
+// AVLNode is a node in a balanced binary search tree. The heights of the
+// two subtrees of every node differ by at most one, so the height of a
+// tree of n nodes is less than 1.44 log2(n). Counted nodes also keep the
+// size of their subtree, which supports select and rank in O(log n).
+template <typename T, bool Counted = false>
+struct AVLNode : avl_detail::SubtreeSize<Counted>
+{
+    using AVLNodePtr = std::shared_ptr<AVLNode<T, Counted>>;
+
+    AVLNode() = default;
+
+    AVLNode(const T& data) : data(data) { }
+
+    T data;
+    AVLNodePtr left;
+    AVLNodePtr right;
+    int height = 0; // Height of the subtree, 0 for a leaf.
+};
+
+// CountedAVLNode is an AVLNode which keeps the size of its subtree.
+template <typename T>
+using CountedAVLNode = AVLNode<T, true>;
+
+namespace avl_detail
+{
+
+template <typename T, bool C>
+int
+height(const std::shared_ptr<AVLNode<T, C>>& node)
+{
+    return node ? node->height : -1;
+}
+
+template <typename T>
+std::size_t
+size(const std::shared_ptr<AVLNode<T, true>>& node)
+{
+    return node ? node->size : 0;
+}
+
+template <typename T, bool C>
+void
+update(AVLNode<T, C>* node)
+{
+    node->height = 1 + std::max(height(node->left), height(node->right));
+    if constexpr (C) {
+        node->size = 1 + size(node->left) + size(node->right);
+    }
+}
+
+// rotate_right makes the left child of node the root of its subtree.
+template <typename T, bool C>
+void
+rotate_right(std::shared_ptr<AVLNode<T, C>>& node)
+{
+    auto l = std::move(node->left);
+    node->left = std::move(l->right);
+    update(node.get());
+    l->right = std::move(node);
+    node = std::move(l);
+    update(node.get());
+}
+
+// rotate_left makes the right child of node the root of its subtree.
+template <typename T, bool C>
+void
+rotate_left(std::shared_ptr<AVLNode<T, C>>& node)
+{
+    auto r = std::move(node->right);
+    node->right = std::move(r->left);
+    update(node.get());
+    r->left = std::move(node);
+    node = std::move(r);
+    update(node.get());
+}
+
+// rebalance restores the balance of node after one of its subtrees
+// changed height by one.
+template <typename T, bool C>
+void
+rebalance(std::shared_ptr<AVLNode<T, C>>& node)
+{
+    auto balance = height(node->left) - height(node->right);
+    if (balance > 1) {
+        if (height(node->left->left) < height(node->left->right)) {
+            rotate_left(node->left);
+        }
+        rotate_right(node);
+    }
+    else if (balance < -1) {
+        if (height(node->right->right) < height(node->right->left)) {
+            rotate_right(node->right);
+        }
+        rotate_left(node);
+    }
+    else {
+        update(node.get());
+    }
+}
+
+// remove_min detaches the node with the smallest value below node and
+// returns it, rebalancing on the way back up.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+remove_min(std::shared_ptr<AVLNode<T, C>>& node)
+{
+    if (!node->left) {
+        auto min = std::move(node);
+        node = std::move(min->right);
+        return min;
+    }
+    auto min = remove_min(node->left);
+    rebalance(node);
+    return min;
+}
+
+// insert adds v below root and rebalances, with new nodes made by make.
+template <typename T, bool C, typename Make>
+AVLNode<T, C>*
+insert(std::shared_ptr<AVLNode<T, C>>& root, const T& v, Make& make)
+{
+    if (!root) {
+        root = make(v);
+        return root.get();
+    }
+    AVLNode<T, C>* node;
+    if (v < root->data) {
+        node = insert(root->left, v, make);
+    }
+    else if (v > root->data) {
+        node = insert(root->right, v, make);
+    }
+    else {
+        return root.get(); // Ignore dupes.
+    }
+    rebalance(root);
+    return node;
+}
+
+// unlink removes v below root and rebalances. Returns the unlinked node
+// which held v, or nullptr if v is not in the tree.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+unlink(std::shared_ptr<AVLNode<T, C>>& root, const T& v)
+{
+    if (!root) {
+        return nullptr;
+    }
+    std::shared_ptr<AVLNode<T, C>> removed;
+    if (v < root->data) {
+        removed = unlink(root->left, v);
+    }
+    else if (v > root->data) {
+        removed = unlink(root->right, v);
+    }
+    else {
+        removed = std::move(root);
+        if (!removed->left) {
+            root = std::move(removed->right);
+        }
+        else if (!removed->right) {
+            root = std::move(removed->left);
+        }
+        else {
+            auto successor = remove_min(removed->right);
+            successor->left = std::move(removed->left);
+            successor->right = std::move(removed->right);
+            root = std::move(successor);
+        }
+    }
+    if (removed && root) {
+        rebalance(root);
+    }
+    return removed;
+}
+
+}
+
+// insert adds v to the tree at root and rebalances it, which may replace
+// root. Returns the node containing v.
+template <typename T, bool C>
+AVLNode<T, C>*
+insert(std::shared_ptr<AVLNode<T, C>>& root, const T& v)
+{
+    auto make = [](const T& v) { return std::make_shared<AVLNode<T, C>>(v); };
+    return avl_detail::insert(root, v, make);
+}
+
+// insert is insert which takes new nodes from pool.
+template <typename T, bool C>
+AVLNode<T, C>*
+insert(std::shared_ptr<AVLNode<T, C>>& root, const T& v, NodePool<AVLNode<T, C>>& pool)
+{
+    auto make = [&pool](const T& v) { return pool.acquire(v); };
+    return avl_detail::insert(root, v, make);
+}
+
+// erase removes v from the tree at root and rebalances it, which may
+// replace root. A node with two children is replaced by its successor.
+// Returns true if v was in the tree.
+template <typename T, bool C>
+bool
+erase(std::shared_ptr<AVLNode<T, C>>& root, const T& v)
+{
+    return bool(avl_detail::unlink(root, v));
+}
+
+// erase is erase which puts the removed node on the free list of pool.
+template <typename T, bool C>
+bool
+erase(std::shared_ptr<AVLNode<T, C>>& root, const T& v, NodePool<AVLNode<T, C>>& pool)
+{
+    auto removed = avl_detail::unlink(root, v);
+    if (!removed) {
+        return false;
+    }
+    pool.recycle(std::move(removed));
+    return true;
+}
+
+// make_avl returns balanced bst initialized from container of values.
+template <typename T, bool Counted = false>
+std::shared_ptr<AVLNode<T, Counted>>
+make_avl(const std::vector<T>& values)
+{
+    std::shared_ptr<AVLNode<T, Counted>> root;
+    for (const auto& v : values) {
+        insert(root, v);
+    }
+    return root;
+}
+
+// make_vector returns vector initialized from tree.
+template <typename T, bool C>
+std::vector<T>
+make_vector(const AVLNode<T, C>* root, const Order& order=inorder)
+{
+    return bst_detail::make_vector<T>(root, order);
+}
+
+// find returns the node containing value or nullptr if not in tree.
+template <typename T, bool C>
+const AVLNode<T, C>*
+find(const AVLNode<T, C>* root, const T& v)
+{
+    return bst_detail::find(root, v);
+}
+
+// tree_height returns the height of the tree.
+template <typename T, bool C>
+std::size_t
+tree_height(const AVLNode<T, C>* root)
+{
+    return root ? root->height : 0;
+}
+
+// tree_size returns the number of elements in the tree.
+template <typename T>
+std::size_t
+tree_size(const CountedAVLNode<T>* root)
+{
+    return root ? root->size : 0;
+}
+
+// select returns the node holding the kth smallest value, counting from
+// 0, or nullptr if the tree has k or fewer values.
+template <typename T>
+const CountedAVLNode<T>*
+select(const CountedAVLNode<T>* root, std::size_t k)
+{
+    while (root) {
+        auto left = root->left ? root->left->size : 0;
+        if (k < left) {
+            root = root->left.get();
+        }
+        else if (k > left) {
+            k -= left + 1;
+            root = root->right.get();
+        }
+        else {
+            break;
+        }
+    }
+    return root;
+}
+
+// rank returns the number of values in the tree less than v.
+template <typename T>
+std::size_t
+rank(const CountedAVLNode<T>* root, const T& v)
+{
+    std::size_t r = 0;
+    while (root) {
+        if (root->data < v) {
+            r += 1 + (root->left ? root->left->size : 0);
+            root = root->right.get();
+        }
+        else {
+            root = root->left.get();
+        }
+    }
+    return r;
+}
+
+namespace avl_detail
+{
+
+// join_right hangs mid over the right spine of node, which is taller than
+// right by more than one, with right as its right subtree, and rebalances
+// on the way back up.
+template <typename T, bool C>
+void
+join_right(std::shared_ptr<AVLNode<T, C>>& node, std::shared_ptr<AVLNode<T, C>> mid,
+           std::shared_ptr<AVLNode<T, C>> right)
+{
+    if (height(node->right) <= height(right) + 1) {
+        mid->left = std::move(node->right);
+        mid->right = std::move(right);
+        update(mid.get());
+        node->right = std::move(mid);
+    }
+    else {
+        join_right(node->right, std::move(mid), std::move(right));
+    }
+    rebalance(node);
+}
+
+// join_left is join_right along the left spine of node.
+template <typename T, bool C>
+void
+join_left(std::shared_ptr<AVLNode<T, C>>& node, std::shared_ptr<AVLNode<T, C>> left,
+          std::shared_ptr<AVLNode<T, C>> mid)
+{
+    if (height(node->left) <= height(left) + 1) {
+        mid->left = std::move(left);
+        mid->right = std::move(node->left);
+        update(mid.get());
+        node->left = std::move(mid);
+    }
+    else {
+        join_left(node->left, std::move(left), std::move(mid));
+    }
+    rebalance(node);
+}
+
+// join returns the tree of the values of left, then the node mid, then
+// the values of right, where every value of left is less than mid and
+// every value of right greater. Costs O(|h(left) - h(right)| + 1).
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+join(std::shared_ptr<AVLNode<T, C>> left, std::shared_ptr<AVLNode<T, C>> mid,
+     std::shared_ptr<AVLNode<T, C>> right)
+{
+    if (height(left) > height(right) + 1) {
+        join_right(left, std::move(mid), std::move(right));
+        return left;
+    }
+    if (height(right) > height(left) + 1) {
+        join_left(right, std::move(left), std::move(mid));
+        return right;
+    }
+    mid->left = std::move(left);
+    mid->right = std::move(right);
+    update(mid.get());
+    return mid;
+}
+
+// join2 is join without a middle node.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+join2(std::shared_ptr<AVLNode<T, C>> left, std::shared_ptr<AVLNode<T, C>> right)
+{
+    if (!right) {
+        return left;
+    }
+    auto mid = remove_min(right);
+    return join(std::move(left), std::move(mid), std::move(right));
+}
+
+// Split is a tree split around a value: the values less than it, the
+// node holding it if any and the values greater than it.
+template <typename T, bool C>
+struct Split
+{
+    std::shared_ptr<AVLNode<T, C>> left;
+    std::shared_ptr<AVLNode<T, C>> mid;
+    std::shared_ptr<AVLNode<T, C>> right;
+};
+
+// split splits root around v in O(log n), joining the subtrees hanging
+// off the search path back together on each side.
+template <typename T, bool C>
+Split<T, C>
+split(std::shared_ptr<AVLNode<T, C>> root, const T& v)
+{
+    if (!root) {
+        return {};
+    }
+    auto left = std::move(root->left);
+    auto right = std::move(root->right);
+    if (v < root->data) {
+        auto s = split(std::move(left), v);
+        s.right = join(std::move(s.right), std::move(root), std::move(right));
+        return s;
+    }
+    if (v > root->data) {
+        auto s = split(std::move(right), v);
+        s.left = join(std::move(left), std::move(root), std::move(s.left));
+        return s;
+    }
+    return {std::move(left), std::move(root), std::move(right)};
+}
+
+// grain_height returns the height below which subtrees of about grain
+// values are merged sequentially.
+inline int
+grain_height(std::size_t grain)
+{
+    int h = 0;
+    while (grain > 1) {
+        grain /= 2;
+        ++h;
+    }
+    return h;
+}
+
+// SetOp selects the values of a set operation.
+enum class SetOp { set_union, set_intersection, set_difference };
+
+// set_op splits b around the root of a and combines the results of the
+// operation on the two sides, as parallel tasks if pool is not null and
+// either tree is taller than grain. Nodes of a and b are reused for the
+// result or released.
+template <SetOp Op, typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+set_op(TaskPool* pool, std::shared_ptr<AVLNode<T, C>> a, std::shared_ptr<AVLNode<T, C>> b, int grain)
+{
+    if (!a || !b) {
+        return Op == SetOp::set_union ? (a ? std::move(a) : std::move(b))
+             : Op == SetOp::set_intersection ? nullptr
+             : std::move(a);
+    }
+    auto parallel = pool && std::max(height(a), height(b)) > grain;
+    auto left = std::move(a->left);
+    auto right = std::move(a->right);
+    auto s = split(std::move(b), a->data);
+    std::shared_ptr<AVLNode<T, C>> l;
+    std::shared_ptr<AVLNode<T, C>> r;
+    auto op_left = [&] { l = set_op<Op>(pool, std::move(left), std::move(s.left), grain); };
+    auto op_right = [&] { r = set_op<Op>(pool, std::move(right), std::move(s.right), grain); };
+    if (parallel) {
+        pool->invoke(op_left, op_right);
+    }
+    else {
+        op_left();
+        op_right();
+    }
+    auto keep = Op == SetOp::set_union || (Op == SetOp::set_intersection) == bool(s.mid);
+    return keep ? join(std::move(l), std::move(a), std::move(r)) : join2(std::move(l), std::move(r));
+}
+
+}
+
+// tree_union returns the tree of the values in a or b. The trees are
+// consumed, their nodes becoming the nodes of the result. Merging m values
+// into n costs O(m log(n/m + 1)), so merging a small tree into a large one
+// is cheap.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+tree_union(std::shared_ptr<AVLNode<T, C>> a, std::shared_ptr<AVLNode<T, C>> b)
+{
+    return avl_detail::set_op<avl_detail::SetOp::set_union>(nullptr, std::move(a), std::move(b), 0);
+}
+
+// tree_union is the parallel version of tree_union. Subtrees of more than
+// about grain values are merged as parallel tasks on pool.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+tree_union(TaskPool& pool, std::shared_ptr<AVLNode<T, C>> a, std::shared_ptr<AVLNode<T, C>> b,
+           std::size_t grain = 1 << 14)
+{
+    return avl_detail::set_op<avl_detail::SetOp::set_union>(
+        &pool, std::move(a), std::move(b), avl_detail::grain_height(grain));
+}
+
+// tree_intersection returns the tree of the values in both a and b,
+// consuming the trees.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+tree_intersection(std::shared_ptr<AVLNode<T, C>> a, std::shared_ptr<AVLNode<T, C>> b)
+{
+    return avl_detail::set_op<avl_detail::SetOp::set_intersection>(nullptr, std::move(a), std::move(b), 0);
+}
+
+// tree_intersection is the parallel version of tree_intersection.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+tree_intersection(TaskPool& pool, std::shared_ptr<AVLNode<T, C>> a, std::shared_ptr<AVLNode<T, C>> b,
+                  std::size_t grain = 1 << 14)
+{
+    return avl_detail::set_op<avl_detail::SetOp::set_intersection>(
+        &pool, std::move(a), std::move(b), avl_detail::grain_height(grain));
+}
+
+// tree_difference returns the tree of the values in a but not in b,
+// consuming the trees.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+tree_difference(std::shared_ptr<AVLNode<T, C>> a, std::shared_ptr<AVLNode<T, C>> b)
+{
+    return avl_detail::set_op<avl_detail::SetOp::set_difference>(nullptr, std::move(a), std::move(b), 0);
+}
+
+// tree_difference is the parallel version of tree_difference.
+template <typename T, bool C>
+std::shared_ptr<AVLNode<T, C>>
+tree_difference(TaskPool& pool, std::shared_ptr<AVLNode<T, C>> a, std::shared_ptr<AVLNode<T, C>> b,
+                std::size_t grain = 1 << 14)
+{
+    return avl_detail::set_op<avl_detail::SetOp::set_difference>(
+        &pool, std::move(a), std::move(b), avl_detail::grain_height(grain));
+}
+
+}
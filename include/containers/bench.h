@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+
+namespace containers
+{
+
+// elapsed_ms returns the wall clock time in milliseconds taken to call f.
+template <typename F>
+double elapsed_ms(F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// do_not_optimize prevents the compiler from discarding the computation of v.
+template <typename T>
+void do_not_optimize(const T& v)
+{
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+}
@@ -0,0 +1,847 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "containers/work_stealing.h"
+
+namespace containers
+{
+
+// BSTNode is a node in a binary search tree.
+template <typename T>
+struct BSTNode
+{
+    using BSTNodePtr = std::shared_ptr<BSTNode<T>>;
+
+    BSTNode() = default;
+
+    BSTNode(const T& data) : data(data) { }
+
+    BSTNode(const BSTNode&) = default;
+    BSTNode(BSTNode&&) = default;
+    BSTNode& operator=(const BSTNode&) = default;
+    BSTNode& operator=(BSTNode&&) = default;
+
+    ~BSTNode()
+    {
+        // Take ownership of uniquely owned descendants one at a time so
+        // that destroying a degenerate tree, such as a splay tree after
+        // ascending inserts, does not recurse once per level.
+        std::vector<BSTNodePtr> pending;
+        release(left, pending);
+        release(right, pending);
+        while (!pending.empty()) {
+            auto node = std::move(pending.back());
+            pending.pop_back();
+            release(node->left, pending);
+            release(node->right, pending);
+        }
+    }
+
+    BSTNode<T>* insert(const T& v)
+    {
+        if (v < data) {
+            if (left) {
+                return left->insert(v);
+            }
+            left = std::make_shared<BSTNode<T>>(v);
+            return left.get();
+        }
+        else if (v > data) {
+            if (right) {
+                return right->insert(v);
+            }
+            right = std::make_shared<BSTNode<T>>(v);
+            return right.get();
+        }
+        return this; // Ignore dupes.
+    }
+
+    T data;
+    BSTNodePtr left;
+    BSTNodePtr right;
+
+private:
+    static void release(BSTNodePtr& child, std::vector<BSTNodePtr>& pending)
+    {
+        if (child && child.use_count() == 1) {
+            pending.push_back(std::move(child));
+        }
+    }
+};
+
+// make_bst returns bst initialized from container of values.
+template <typename T>
+std::shared_ptr<BSTNode<T>>
+make_bst(const std::vector<T>& values)
+{
+    std::shared_ptr<BSTNode<T>> root;
+
+    for (const auto& v : values) {
+        if (!root) {
+            root = std::make_shared<BSTNode<T>>(v);
+        }
+        else {
+            root->insert(v);
+        }
+    }
+
+    return root;
+}
+
+// NodePool is a free list of nodes removed from a tree by erase, reused
+// by insert so that churn does not allocate. Each node keeps its
+// shared_ptr control block. A node still referenced from outside the
+// tree is left to its other owners instead.
+template <typename Node>
+class NodePool
+{
+public:
+    // acquire returns an unlinked node holding data, reusing a node from
+    // the free list if there is one.
+    template <typename V>
+    std::shared_ptr<Node> acquire(const V& data)
+    {
+        if (free.empty()) {
+            return std::make_shared<Node>(data);
+        }
+        auto node = std::move(free.back());
+        free.pop_back();
+        *node = Node(data);
+        return node;
+    }
+
+    // recycle adds node, which must be unlinked, to the free list.
+    void recycle(std::shared_ptr<Node> node)
+    {
+        if (node && node.use_count() == 1) {
+            free.push_back(std::move(node));
+        }
+    }
+
+    // size returns the number of nodes on the free list.
+    std::size_t size() const
+    {
+        return free.size();
+    }
+
+    // shrink_to_fit releases the nodes on the free list.
+    void shrink_to_fit()
+    {
+        free.clear();
+        free.shrink_to_fit();
+    }
+
+private:
+    std::vector<std::shared_ptr<Node>> free;
+};
+
+namespace bst_detail
+{
+
+// insert adds v below root without recursing, with new nodes made by
+// make. Returns the node containing v.
+template <typename Node, typename V, typename Make>
+Node*
+insert(std::shared_ptr<Node>& root, const V& v, Make make)
+{
+    auto slot = &root;
+    while (*slot) {
+        auto node = slot->get();
+        if (v < node->data) {
+            slot = &node->left;
+        }
+        else if (v > node->data) {
+            slot = &node->right;
+        }
+        else {
+            return node; // Ignore dupes.
+        }
+    }
+    *slot = make(v);
+    return slot->get();
+}
+
+// unlink removes v from the tree at root without recursing and returns
+// the unlinked node which held it, or nullptr if v is not in the tree.
+// A node with two children is replaced by its successor.
+template <typename Node, typename V>
+std::shared_ptr<Node>
+unlink(std::shared_ptr<Node>& root, const V& v)
+{
+    auto slot = &root;
+    while (*slot) {
+        auto node = slot->get();
+        if (v < node->data) {
+            slot = &node->left;
+        }
+        else if (v > node->data) {
+            slot = &node->right;
+        }
+        else {
+            break;
+        }
+    }
+    if (!*slot) {
+        return nullptr;
+    }
+    auto removed = std::move(*slot);
+    if (!removed->left) {
+        *slot = std::move(removed->right);
+    }
+    else if (!removed->right) {
+        *slot = std::move(removed->left);
+    }
+    else {
+        // Unlink the leftmost node of the right subtree and put it in
+        // place of the removed node.
+        auto min = &removed->right;
+        while ((*min)->left) {
+            min = &(*min)->left;
+        }
+        auto successor = std::move(*min);
+        *min = std::move(successor->right);
+        successor->left = std::move(removed->left);
+        successor->right = std::move(removed->right);
+        *slot = std::move(successor);
+    }
+    return removed;
+}
+
+}
+
+// insert adds v to the tree at root, taking new nodes from pool.
+// Returns the node containing v.
+template <typename T>
+BSTNode<T>*
+insert(std::shared_ptr<BSTNode<T>>& root, const T& v, NodePool<BSTNode<T>>& pool)
+{
+    return bst_detail::insert(root, v, [&pool](const T& v) { return pool.acquire(v); });
+}
+
+// erase removes v from the tree at root and returns true if it was in
+// the tree. A node with two children is replaced by its successor.
+template <typename T>
+bool
+erase(std::shared_ptr<BSTNode<T>>& root, const T& v)
+{
+    return bool(bst_detail::unlink(root, v));
+}
+
+// erase is erase which puts the removed node on the free list of pool.
+template <typename T>
+bool
+erase(std::shared_ptr<BSTNode<T>>& root, const T& v, NodePool<BSTNode<T>>& pool)
+{
+    auto removed = bst_detail::unlink(root, v);
+    if (!removed) {
+        return false;
+    }
+    pool.recycle(std::move(removed));
+    return true;
+}
+
+struct values_not_sorted_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// NodeArena is one block of memory for the n nodes of a tree built at
+// once, so the nodes are contiguous instead of scattered over the heap.
+// Allocation is a thread safe bump of a slot counter; requests beyond the
+// n slots fall back to operator new. The block is freed with the arena,
+// which lives until the last node allocated from it is destroyed.
+class NodeArena
+{
+public:
+    explicit NodeArena(std::size_t n) : nslots(n) { }
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    ~NodeArena()
+    {
+        ::operator delete(block);
+    }
+
+    void* allocate(std::size_t bytes)
+    {
+        // Every node of a tree is the same size, so the size of the first
+        // request sets the size of the slots.
+        std::call_once(once, [this, bytes] {
+            slot = (bytes + alignof(std::max_align_t) - 1)/alignof(std::max_align_t)*alignof(std::max_align_t);
+            block = static_cast<char*>(::operator new(slot*nslots));
+        });
+        if (bytes <= slot) {
+            auto i = next.fetch_add(1, std::memory_order_relaxed);
+            if (i < nslots) {
+                return block + i*slot;
+            }
+        }
+        return ::operator new(bytes);
+    }
+
+    void deallocate(void* p)
+    {
+        // Slots are only reclaimed with the whole block.
+        auto c = static_cast<char*>(p);
+        if (!block || c < block || c >= block + slot*nslots) {
+            ::operator delete(p);
+        }
+    }
+
+private:
+    std::size_t nslots;
+    std::size_t slot = 0;
+    char* block = nullptr;
+    std::once_flag once;
+    std::atomic<std::size_t> next{0};
+};
+
+// ArenaAllocator allocates from a NodeArena it shares ownership of. Used
+// with std::allocate_shared, each node keeps the arena alive, so any
+// subtree remains valid after the rest of the tree is released.
+template <typename U>
+struct ArenaAllocator
+{
+    using value_type = U;
+
+    explicit ArenaAllocator(std::shared_ptr<NodeArena> arena) : arena(std::move(arena)) { }
+
+    template <typename V>
+    ArenaAllocator(const ArenaAllocator<V>& other) : arena(other.arena) { }
+
+    U* allocate(std::size_t n)
+    {
+        return static_cast<U*>(arena->allocate(n*sizeof(U)));
+    }
+
+    void deallocate(U* p, std::size_t)
+    {
+        arena->deallocate(p);
+    }
+
+    template <typename V>
+    bool operator==(const ArenaAllocator<V>& other) const
+    {
+        return arena == other.arena;
+    }
+
+    template <typename V>
+    bool operator!=(const ArenaAllocator<V>& other) const
+    {
+        return arena != other.arena;
+    }
+
+    std::shared_ptr<NodeArena> arena;
+};
+
+namespace bst_detail
+{
+
+// unique_sorted returns values, or a copy without duplicates if needed,
+// and throws if values are not sorted.
+template <typename T>
+const std::vector<T>&
+unique_sorted(const std::vector<T>& values, std::vector<T>& copy)
+{
+    if (!std::is_sorted(values.begin(), values.end())) {
+        throw values_not_sorted_error{"values are not sorted"};
+    }
+    if (std::adjacent_find(values.begin(), values.end()) == values.end()) {
+        return values;
+    }
+    copy = values;
+    copy.erase(std::unique(copy.begin(), copy.end()), copy.end());
+    return copy;
+}
+
+// build_sorted returns a perfectly balanced tree of values[lo, hi), each
+// subtree rooted at the middle of its range. Nodes are allocated in level
+// order so the top levels, which every search visits, are adjacent.
+template <typename T>
+std::shared_ptr<BSTNode<T>>
+build_sorted(const std::vector<T>& values, std::size_t lo, std::size_t hi,
+             const ArenaAllocator<BSTNode<T>>& alloc)
+{
+    std::shared_ptr<BSTNode<T>> root;
+    std::queue<std::tuple<std::size_t, std::size_t, std::shared_ptr<BSTNode<T>>*>> ranges;
+    if (lo < hi) {
+        ranges.emplace(lo, hi, &root);
+    }
+    while (!ranges.empty()) {
+        auto [l, h, node] = ranges.front();
+        ranges.pop();
+        auto mid = l + (h - l)/2;
+        *node = std::allocate_shared<BSTNode<T>>(alloc, values[mid]);
+        if (l < mid) {
+            ranges.emplace(l, mid, &(*node)->left);
+        }
+        if (mid + 1 < h) {
+            ranges.emplace(mid + 1, h, &(*node)->right);
+        }
+    }
+    return root;
+}
+
+// build_sorted splits ranges of more than grain values at the middle
+// value and builds the two halves, as parallel tasks if pool is not null.
+// Splitting keeps the queue of the level order build small.
+template <typename T>
+std::shared_ptr<BSTNode<T>>
+build_sorted(TaskPool* pool, const std::vector<T>& values, std::size_t lo, std::size_t hi,
+             const ArenaAllocator<BSTNode<T>>& alloc, std::size_t grain)
+{
+    if (hi - lo <= grain) {
+        return build_sorted(values, lo, hi, alloc);
+    }
+    auto mid = lo + (hi - lo)/2;
+    auto node = std::allocate_shared<BSTNode<T>>(alloc, values[mid]);
+    auto build_left = [&] { node->left = build_sorted(pool, values, lo, mid, alloc, grain); };
+    auto build_right = [&] { node->right = build_sorted(pool, values, mid + 1, hi, alloc, grain); };
+    if (pool) {
+        pool->invoke(build_left, build_right);
+    }
+    else {
+        build_left();
+        build_right();
+    }
+    return node;
+}
+
+}
+
+// make_bst_sorted returns a perfectly balanced bst initialized from sorted
+// values in linear time, with the nodes allocated in one block.
+// Duplicates are ignored and unsorted values throw values_not_sorted_error.
+template <typename T>
+std::shared_ptr<BSTNode<T>>
+make_bst_sorted(const std::vector<T>& values)
+{
+    std::vector<T> copy;
+    const auto& unique = bst_detail::unique_sorted(values, copy);
+    ArenaAllocator<BSTNode<T>> alloc(std::make_shared<NodeArena>(unique.size()));
+    return bst_detail::build_sorted<T>(nullptr, unique, 0, unique.size(), alloc, 1 << 14);
+}
+
+// make_bst_sorted is the parallel version of make_bst_sorted. Subtrees of
+// more than grain values are built by building their halves as parallel
+// tasks on pool.
+template <typename T>
+std::shared_ptr<BSTNode<T>>
+make_bst_sorted(TaskPool& pool, const std::vector<T>& values, std::size_t grain = 1 << 14)
+{
+    std::vector<T> copy;
+    const auto& unique = bst_detail::unique_sorted(values, copy);
+    ArenaAllocator<BSTNode<T>> alloc(std::make_shared<NodeArena>(unique.size()));
+    return bst_detail::build_sorted(&pool, unique, 0, unique.size(), alloc, std::max<std::size_t>(grain, 1));
+}
+
+// Order is a traversal order.
+enum Order { preorder, inorder, postorder };
+
+// BSTStack is a reusable buffer of nodes used by traverse so repeated
+// traversals do not allocate.
+template <typename Node>
+using BSTStack = std::vector<const Node*>;
+
+namespace bst_detail
+{
+
+// visit calls f(node) and returns false if f asked to stop. Visitors
+// which return void never stop.
+template <typename Visit, typename Node>
+bool
+visit(Visit& f, const Node* node)
+{
+    if constexpr (std::is_void_v<decltype(f(node))>) {
+        f(node);
+        return true;
+    }
+    else {
+        return bool(f(node));
+    }
+}
+
+}
+
+// traverse calls visit(node) for the nodes of the tree in order, stopping
+// early if visit returns false. Returns true if every node was visited.
+// The traversal is iterative, using stack for the nodes still to visit.
+template <typename Node, typename Visit>
+bool
+traverse(const Node* root, const Order& order, Visit visit, BSTStack<Node>& stack)
+{
+    stack.clear();
+    auto node = root;
+    switch (order) {
+    case Order::preorder:
+        // Walk down the left links, saving right children for later.
+        while (node || !stack.empty()) {
+            if (!node) {
+                node = stack.back();
+                stack.pop_back();
+            }
+            if (!bst_detail::visit(visit, node)) {
+                return false;
+            }
+            if (node->right) {
+                stack.push_back(node->right.get());
+            }
+            node = node->left.get();
+        }
+        break;
+    case Order::inorder:
+        while (node || !stack.empty()) {
+            for (; node; node = node->left.get()) {
+                stack.push_back(node);
+            }
+            node = stack.back();
+            stack.pop_back();
+            if (!bst_detail::visit(visit, node)) {
+                return false;
+            }
+            node = node->right.get();
+        }
+        break;
+    case Order::postorder:
+        {
+        // A node is visited once its right subtree was the last visited.
+        const Node* last = nullptr;
+        while (node || !stack.empty()) {
+            for (; node; node = node->left.get()) {
+                stack.push_back(node);
+            }
+            auto top = stack.back();
+            if (top->right && top->right.get() != last) {
+                node = top->right.get();
+                continue;
+            }
+            if (!bst_detail::visit(visit, top)) {
+                return false;
+            }
+            last = top;
+            stack.pop_back();
+        }
+        break;
+        }
+    }
+    return true;
+}
+
+template <typename Node, typename Visit>
+bool
+traverse(const Node* root, const Order& order, Visit visit)
+{
+    BSTStack<Node> stack;
+    return traverse(root, order, visit, stack);
+}
+
+namespace bst_detail
+{
+
+// make_vector returns vector initialized from tree of any binary search
+// tree node type with data, left and right members.
+template <typename T, typename Node>
+std::vector<T>
+make_vector(const Node* root, const Order& order)
+{
+    std::vector<T> values;
+    traverse(root, order, [&values](const Node* node) {
+        values.push_back(node->data);
+    });
+    return values;
+}
+
+// find returns the node containing v or nullptr if not in tree.
+template <typename Node, typename T>
+const Node*
+find(const Node* root, const T& v)
+{
+    while (root) {
+        if (v < root->data) {
+            root = root->left.get();
+        }
+        else if (v > root->data) {
+            root = root->right.get();
+        }
+        else {
+            break; // v == data.
+        }
+    }
+    return root;
+}
+
+// height returns the height of the tree, using an explicit stack since
+// an unbalanced tree may be as deep as it is large.
+template <typename Node>
+std::size_t
+height(const Node* root)
+{
+    std::size_t h = 0;
+    std::vector<std::pair<const Node*, std::size_t>> stack;
+    if (root) {
+        stack.emplace_back(root, 0);
+    }
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        h = std::max(h, depth);
+        if (node->left) {
+            stack.emplace_back(node->left.get(), depth + 1);
+        }
+        if (node->right) {
+            stack.emplace_back(node->right.get(), depth + 1);
+        }
+    }
+    return h;
+}
+
+}
+
+// make_vector returns vector initialized from tree.
+template <typename T>
+std::vector<T>
+make_vector(const BSTNode<T>* root, const Order& order=inorder)
+{
+    return bst_detail::make_vector<T>(root, order);
+}
+
+// find returns the node containig value or nullptr if not in tree.
+template <typename T>
+const BSTNode<T>*
+find(const BSTNode<T>* root, const T& v)
+{
+    return bst_detail::find(root, v);
+}
+
+// tree_height returns the height of the tree.
+template <typename T>
+std::size_t
+tree_height(const BSTNode<T>* root)
+{
+    return bst_detail::height(root);
+}
+
+
+// BSTIterator visits the nodes of a binary search tree in order. It keeps
+// the path from the root to the current node, so it moves in either
+// direction without parent pointers and costs O(1) amortized per step.
+template <typename Node>
+class BSTIterator
+{
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::decay_t<decltype(std::declval<Node>().data)>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    BSTIterator() = default;
+
+    // BSTIterator returns the end iterator of the tree at root.
+    explicit BSTIterator(const Node* root) : root(root) { }
+
+    reference operator*() const
+    {
+        return path.back()->data;
+    }
+
+    pointer operator->() const
+    {
+        return &path.back()->data;
+    }
+
+    // node returns the current node.
+    const Node* node() const
+    {
+        return path.back();
+    }
+
+    BSTIterator& operator++()
+    {
+        auto node = path.back();
+        if (node->right) {
+            descend(node->right.get(), &Node::left);
+        }
+        else {
+            // Climb until the node left behind is a left child.
+            const Node* child;
+            do {
+                child = path.back();
+                path.pop_back();
+            } while (!path.empty() && path.back()->right.get() == child);
+        }
+        return *this;
+    }
+
+    BSTIterator operator++(int)
+    {
+        auto it = *this;
+        ++*this;
+        return it;
+    }
+
+    BSTIterator& operator--()
+    {
+        if (path.empty()) {
+            // Before the end is the largest value.
+            if (root) {
+                descend(root, &Node::right);
+            }
+            return *this;
+        }
+        auto node = path.back();
+        if (node->left) {
+            descend(node->left.get(), &Node::right);
+        }
+        else {
+            const Node* child;
+            do {
+                child = path.back();
+                path.pop_back();
+            } while (!path.empty() && path.back()->left.get() == child);
+        }
+        return *this;
+    }
+
+    BSTIterator operator--(int)
+    {
+        auto it = *this;
+        --*this;
+        return it;
+    }
+
+    bool operator==(const BSTIterator& rhs) const
+    {
+        if (path.empty() || rhs.path.empty()) {
+            return path.empty() && rhs.path.empty();
+        }
+        return path.back() == rhs.path.back();
+    }
+
+    bool operator!=(const BSTIterator& rhs) const
+    {
+        return !(*this == rhs);
+    }
+
+private:
+    template <typename N, typename V>
+    friend BSTIterator<N> bst_bound(const N*, const V&, bool);
+    template <typename N>
+    friend BSTIterator<N> inorder_begin(const N*);
+
+    const Node* root = nullptr;
+    std::vector<const Node*> path;
+
+    // descend pushes node and then follows child links from it.
+    template <typename Child>
+    void descend(const Node* node, Child child)
+    {
+        for (; node; node = (node->*child).get()) {
+            path.push_back(node);
+        }
+    }
+};
+
+// bst_bound returns an iterator to the first value not less than v, or
+// greater than v if upper. The path to it is a prefix of the search path.
+template <typename Node, typename V>
+BSTIterator<Node>
+bst_bound(const Node* root, const V& v, bool upper)
+{
+    BSTIterator<Node> it(root);
+    std::size_t found = 0;
+    for (auto node = root; node; ) {
+        it.path.push_back(node);
+        if (upper ? v < node->data : !(node->data < v)) {
+            found = it.path.size();
+            node = node->left.get();
+        }
+        else {
+            node = node->right.get();
+        }
+    }
+    it.path.resize(found);
+    return it;
+}
+
+// inorder_begin returns an iterator to the smallest value in the tree.
+template <typename Node>
+BSTIterator<Node>
+inorder_begin(const Node* root)
+{
+    BSTIterator<Node> it(root);
+    it.descend(root, &Node::left);
+    return it;
+}
+
+// inorder_end returns the iterator past the largest value in the tree.
+template <typename Node>
+BSTIterator<Node>
+inorder_end(const Node* root)
+{
+    return BSTIterator<Node>(root);
+}
+
+// lower_bound returns an iterator to the first value not less than v.
+template <typename Node, typename V>
+BSTIterator<Node>
+lower_bound(const Node* root, const V& v)
+{
+    return bst_bound(root, v, false);
+}
+
+// upper_bound returns an iterator to the first value greater than v.
+template <typename Node, typename V>
+BSTIterator<Node>
+upper_bound(const Node* root, const V& v)
+{
+    return bst_bound(root, v, true);
+}
+
+// range calls visit(value) in order for every value in [lo, hi). Only
+// subtrees which may hold values in the range are entered, so the cost
+// is O(h + k) for a tree of height h and k values visited.
+template <typename Node, typename V, typename Visit>
+void
+range(const Node* root, const V& lo, const V& hi, Visit visit)
+{
+    std::vector<const Node*> stack;
+    auto node = root;
+    for (;;) {
+        while (node) {
+            if (node->data < lo) {
+                node = node->right.get(); // Left subtree below lo.
+            }
+            else {
+                stack.push_back(node);
+                node = node->left.get();
+            }
+        }
+        if (stack.empty()) {
+            return;
+        }
+        node = stack.back();
+        stack.pop_back();
+        if (!(node->data < hi)) {
+            return;
+        }
+        visit(node->data);
+        node = node->right.get();
+    }
+}
+
+}
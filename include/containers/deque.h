@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace containers
+{
+
+struct deque_empty_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// node is a node in a double linked list.
+// The data of a node on the free list is empty.
+template <typename T>
+struct node
+{
+    std::optional<T> data;
+    std::unique_ptr<node<T>> next;
+    node<T>* prev = nullptr;
+};
+
+// Deque is a double ended queue that provides constant time front and back.
+// You can think of the interface as the union of a Stack and Queue.
+// Popped nodes are kept on a free list and reused by later pushes.
+template <typename T>
+class Deque
+{
+public:
+    Deque() = default;
+
+    Deque(Deque&& other) noexcept
+    {
+        swap(other);
+    }
+
+    Deque& operator=(Deque&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~Deque()
+    {
+        // Unlink one node at a time, destroying nodes recursively
+        // through next would use stack proportional to the length.
+        while (head) {
+            head = std::move(head->next);
+        }
+        shrink_to_fit();
+    }
+
+    // push_back appends data to end of deque.
+    void push_back(const T& data)
+    {
+        emplace_back(data);
+    }
+
+    void push_back(T&& data)
+    {
+        emplace_back(std::move(data));
+    }
+
+    // emplace_back constructs a value in place at the end of deque.
+    template <typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        auto n = acquire(std::forward<Args>(args)...);
+        if (!head) {
+            head = std::move(n);
+            tail = head.get();
+        }
+        else {
+            n->prev = tail;
+            tail->next = std::move(n);
+            tail = tail->next.get();
+        }
+        ++nelem;
+        return *tail->data;
+    }
+
+    // back returns but does not remove from back of deque.
+    T& back()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"back from empty deuqe"};
+        }
+        return *tail->data;
+    }
+
+    // pop_back removes but does not return from back of deque.
+    void pop_back()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"pop_back from empty deque"};
+        }
+        std::unique_ptr<node<T>> n;
+        if (head.get() == tail) {
+            n = std::move(head);
+            tail = nullptr;
+        }
+        else {
+            tail = tail->prev;
+            n = std::move(tail->next);
+        }
+        recycle(std::move(n));
+        --nelem;
+    }
+
+    // push_front prepends data to the front of the deque.
+    void push_front(const T& data)
+    {
+        emplace_front(data);
+    }
+
+    void push_front(T&& data)
+    {
+        emplace_front(std::move(data));
+    }
+
+    // emplace_front constructs a value in place at the front of deque.
+    template <typename... Args>
+    T& emplace_front(Args&&... args)
+    {
+        auto n = acquire(std::forward<Args>(args)...);
+        if (!head) {
+            head = std::move(n);
+            tail = head.get();
+        }
+        else {
+            head->prev = n.get();
+            n->next = std::move(head);
+            head = std::move(n);
+        }
+        ++nelem;
+        return *head->data;
+    }
+
+    // front returns but does not remove from front of deque.
+    T& front()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"front from empty deque"};
+        }
+        return *head->data;
+    }
+
+    // pop_front removes but does not return from front of deque.
+    void pop_front()
+    {
+        if (!nelem) {
+            throw deque_empty_error{"pop_front from empty deque"};
+        }
+        auto n = std::move(head);
+        head = std::move(n->next);
+        if (head) {
+            head->prev = nullptr;
+        }
+        else {
+            tail = nullptr;
+        }
+        recycle(std::move(n));
+        --nelem;
+    }
+
+    // size returns number of elements in deque.
+    std::size_t size() const
+    {
+        return nelem;
+    }
+
+    // shrink_to_fit releases the nodes on the free list.
+    void shrink_to_fit()
+    {
+        while (free) {
+            free = std::move(free->next);
+        }
+    }
+
+    void swap(Deque& other) noexcept
+    {
+        std::swap(head, other.head);
+        std::swap(tail, other.tail);
+        std::swap(nelem, other.nelem);
+        std::swap(free, other.free);
+    }
+
+private:
+    std::unique_ptr<node<T>> head;
+    node<T>* tail = nullptr;
+    std::size_t nelem = 0;
+
+    // free is a single linked list of nodes available for reuse.
+    std::unique_ptr<node<T>> free;
+
+    // acquire returns an unlinked node holding a value constructed from
+    // args, reusing a node from the free list if there is one.
+    template <typename... Args>
+    std::unique_ptr<node<T>> acquire(Args&&... args)
+    {
+        std::unique_ptr<node<T>> n;
+        if (free) {
+            n = std::move(free);
+            free = std::move(n->next);
+        }
+        else {
+            n = std::make_unique<node<T>>();
+        }
+        n->data.emplace(std::forward<Args>(args)...);
+        return n;
+    }
+
+    // recycle destroys the value held by n and adds it to the free list.
+    void recycle(std::unique_ptr<node<T>> n)
+    {
+        n->data.reset();
+        n->prev = nullptr;
+        n->next = std::move(free);
+        free = std::move(n);
+    }
+};
+
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace containers
+{
+
+// TreeNode is a node in a binary tree.
+template <typename T>
+struct TreeNode
+{
+    using TreeNodePtr = std::shared_ptr<TreeNode<T>>;
+
+    TreeNode() = default;
+
+    TreeNode(const T& data)
+        : data(data)
+    { }
+
+    ~TreeNode()
+    {
+        // Take ownership of uniquely owned descendants one at a time so
+        // that destroying a deep tree does not recurse once per level.
+        std::vector<TreeNodePtr> pending;
+        release(left, pending);
+        release(right, pending);
+        while (!pending.empty()) {
+            auto node = std::move(pending.back());
+            pending.pop_back();
+            release(node->left, pending);
+            release(node->right, pending);
+        }
+    }
+
+    TreeNode<T>* insert_left(const T& data)
+    {
+        left = std::make_shared<TreeNode<T>>(data);
+        return left.get();
+    }
+
+    TreeNode<T>* insert_right(const T& data)
+    {
+        right = std::make_shared<TreeNode<T>>(data);
+        return right.get();
+    }
+
+    T data;
+    TreeNodePtr left;
+    TreeNodePtr right;
+
+private:
+    static void release(TreeNodePtr& child, std::vector<TreeNodePtr>& pending)
+    {
+        if (child && child.use_count() == 1) {
+            pending.push_back(std::move(child));
+        }
+    }
+};
+
+// make_tree returns a tree initailized from container of values.
+template <typename T>
+std::shared_ptr<TreeNode<T>>
+make_tree(const std::vector<T>& values)
+{
+    // Since this is a binary tree, there is no ordering wrt value.
+    // Values are inserted in level-order as they appear in the
+    // container of values; starting at root and growing downward
+    // adding sibling nodes from left to right.
+    std::shared_ptr<TreeNode<T>> root;
+
+    std::queue<TreeNode<T>*> nodes;
+    for (const auto& v : values) {
+        if (nodes.empty()) {
+            root = std::make_shared<TreeNode<T>>(v);
+            nodes.push(root.get());
+        }
+        else {
+            auto node = nodes.front();
+            if (!node->left) {
+                nodes.push(node->insert_left(v));
+            }
+            else {
+                nodes.push(node->insert_right(v));
+                nodes.pop(); // Both children populated.
+            }
+        }
+    }
+
+    return root;
+}
+
+// make_vector returns a vector initialized from tree.
+template <typename T>
+std::vector<T>
+make_vector(const TreeNode<T>* root)
+{
+    // Since this is a binary tree, there is no ordering wrt value.
+    // Values are inserted into the vector in the order they appear
+    // during a level order traversal of the tree.
+    std::vector<T> values;
+
+    std::queue<const TreeNode<T>*> nodes;
+    if (root) {
+        nodes.push(root);
+    }
+    while (!nodes.empty()) {
+        auto node = nodes.front();
+        values.emplace_back(node->data);
+        if (node->left) {
+            nodes.push(node->left.get());
+        }
+        if (node->right) {
+            nodes.push(node->right.get());
+        }
+        nodes.pop(); // Both children queued.
+    }
+
+    return values;
+}
+
+// TreeStack is a reusable buffer of nodes and their depths used by the
+// iterative traversals so repeated calls do not allocate.
+template <typename T>
+using TreeStack = std::vector<std::pair<const TreeNode<T>*, std::size_t>>;
+
+// tree_height_recursive returns the height of the tree.
+// Uses stack space proportional to the height of the tree.
+template <typename T>
+std::size_t
+tree_height_recursive(const TreeNode<T>* root)
+{
+    if (!root || (!root->left && !root->right)) {
+        // Null node or node with no children has 0 height.
+        return 0;
+    }
+    return 1 + std::max(tree_height_recursive(root->left.get()),
+                        tree_height_recursive(root->right.get()));
+}
+
+// tree_height returns the height of the tree using stack as the
+// explicit stack of nodes still to visit.
+template <typename T>
+std::size_t
+tree_height(const TreeNode<T>* root, TreeStack<T>& stack)
+{
+    std::size_t height = 0;
+    stack.clear();
+    if (root) {
+        stack.emplace_back(root, 0);
+    }
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        height = std::max(height, depth);
+        if (node->left) {
+            stack.emplace_back(node->left.get(), depth + 1);
+        }
+        if (node->right) {
+            stack.emplace_back(node->right.get(), depth + 1);
+        }
+    }
+    return height;
+}
+
+// tree_height returns the height of the tree.
+template <typename T>
+std::size_t
+tree_height(const TreeNode<T>* root)
+{
+    TreeStack<T> stack;
+    return tree_height(root, stack);
+}
+
+// tree_height_morris returns the height of the tree using O(1) space.
+// The tree is temporarily threaded during the traversal and restored
+// before returning, so it must not be shared with another thread.
+template <typename T>
+std::size_t
+tree_height_morris(TreeNode<T>* root)
+{
+    std::size_t height = 0;
+    std::size_t depth = 0;
+    auto node = root;
+    while (node) {
+        if (!node->left) {
+            height = std::max(height, depth);
+            node = node->right.get();
+            ++depth;
+            continue;
+        }
+        // Find the inorder predecessor, counting the edges to reach it.
+        auto pred = node->left.get();
+        std::size_t steps = 1;
+        while (pred->right && pred->right.get() != node) {
+            pred = pred->right.get();
+            ++steps;
+        }
+        if (!pred->right) {
+            // Thread pred back to node with a non-owning pointer.
+            pred->right = typename TreeNode<T>::TreeNodePtr(
+                typename TreeNode<T>::TreeNodePtr(), node);
+            node = node->left.get();
+            ++depth;
+        }
+        else {
+            // Returned to node along the thread from its predecessor.
+            pred->right = nullptr;
+            depth -= steps + 1;
+            height = std::max(height, depth);
+            node = node->right.get();
+            ++depth;
+        }
+    }
+    return height;
+}
+
+// tree_size_recursive returns the number of elements in the tree.
+// Uses stack space proportional to the height of the tree.
+template <typename T>
+std::size_t
+tree_size_recursive(const TreeNode<T>* root)
+{
+    if (!root) {
+        return 0;
+    }
+    return 1 + tree_size_recursive(root->left.get()) + tree_size_recursive(root->right.get());
+}
+
+// tree_size returns the number of elements in the tree using stack as
+// the explicit stack of nodes still to visit.
+template <typename T>
+std::size_t
+tree_size(const TreeNode<T>* root, TreeStack<T>& stack)
+{
+    std::size_t size = 0;
+    stack.clear();
+    if (root) {
+        stack.emplace_back(root, 0);
+    }
+    while (!stack.empty()) {
+        auto node = stack.back().first;
+        stack.pop_back();
+        ++size;
+        if (node->left) {
+            stack.emplace_back(node->left.get(), 0);
+        }
+        if (node->right) {
+            stack.emplace_back(node->right.get(), 0);
+        }
+    }
+    return size;
+}
+
+// tree_size returns the number of elements in the tree.
+template <typename T>
+std::size_t
+tree_size(const TreeNode<T>* root)
+{
+    TreeStack<T> stack;
+    return tree_size(root, stack);
+}
+
+// tree_size_morris returns the number of elements in the tree using O(1)
+// space. The tree is temporarily threaded as in tree_height_morris.
+template <typename T>
+std::size_t
+tree_size_morris(TreeNode<T>* root)
+{
+    std::size_t size = 0;
+    auto node = root;
+    while (node) {
+        if (!node->left) {
+            ++size;
+            node = node->right.get();
+            continue;
+        }
+        auto pred = node->left.get();
+        while (pred->right && pred->right.get() != node) {
+            pred = pred->right.get();
+        }
+        if (!pred->right) {
+            pred->right = typename TreeNode<T>::TreeNodePtr(
+                typename TreeNode<T>::TreeNodePtr(), node);
+            node = node->left.get();
+        }
+        else {
+            pred->right = nullptr;
+            ++size;
+            node = node->right.get();
+        }
+    }
+    return size;
+}
+
+}
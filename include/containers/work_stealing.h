@@ -0,0 +1,437 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace containers
+{
+
+// WorkStealingDeque is the lock-free Chase-Lev deque.
+// The owning thread pushes and pops at the bottom; any other thread
+// may steal from the top. The circular array grows when full and old
+// arrays are kept until the deque is destroyed since a thief may still
+// be reading from them.
+template <typename T>
+class WorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "WorkStealingDeque elements are read racily by thieves");
+
+public:
+    explicit WorkStealingDeque(std::size_t capacity = 64)
+    {
+        std::size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        arrays.push_back(std::make_unique<Array>(n));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // push adds v to the bottom. Only the owner may push.
+    void push(T v)
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto a = array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity() - 1) {
+            a = grow(a, t, b);
+        }
+        a->store(b, v);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // pop removes from the bottom into v. Only the owner may pop.
+    // Returns false when the deque is empty.
+    bool pop(T& v)
+    {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed); // Empty.
+            return false;
+        }
+        v = a->load(b);
+        if (t == b) {
+            // Last element, race against thieves for it.
+            bool won = top.compare_exchange_strong(t, t + 1,
+                                                   std::memory_order_seq_cst,
+                                                   std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // steal removes from the top into v. Any thread may steal.
+    // Returns false when the deque is empty or the steal lost a race.
+    bool steal(T& v)
+    {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        auto a = array.load(std::memory_order_acquire);
+        T tmp = a->load(t);
+        if (!top.compare_exchange_strong(t, t + 1,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+            return false;
+        }
+        v = tmp;
+        return true;
+    }
+
+    // size returns an estimate of the number of elements in the deque.
+    std::size_t size() const
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_relaxed);
+        return b > t ? std::size_t(b - t) : 0;
+    }
+
+    // capacity returns the number of elements the current array holds.
+    std::size_t capacity() const
+    {
+        return array.load(std::memory_order_relaxed)->capacity();
+    }
+
+private:
+    // Array is a circular array indexed by the unbounded top and bottom.
+    class Array
+    {
+    public:
+        explicit Array(std::size_t n) : mask(n - 1), elems(new std::atomic<T>[n]) { }
+
+        std::int64_t capacity() const
+        {
+            return std::int64_t(mask + 1);
+        }
+
+        T load(std::int64_t i) const
+        {
+            return elems[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void store(std::int64_t i, T v)
+        {
+            elems[i & mask].store(v, std::memory_order_relaxed);
+        }
+
+    private:
+        std::size_t mask;
+        std::unique_ptr<std::atomic<T>[]> elems;
+    };
+
+    alignas(64) std::atomic<std::int64_t> top{0};
+    alignas(64) std::atomic<std::int64_t> bottom{0};
+    alignas(64) std::atomic<Array*> array{nullptr};
+
+    // arrays owns the current and all retired arrays.
+    std::vector<std::unique_ptr<Array>> arrays;
+
+    // grow replaces a with an array twice as large holding [t, b).
+    Array* grow(Array* a, std::int64_t t, std::int64_t b)
+    {
+        arrays.push_back(std::make_unique<Array>(2*a->capacity()));
+        auto grown = arrays.back().get();
+        for (auto i = t; i < b; ++i) {
+            grown->store(i, a->load(i));
+        }
+        array.store(grown, std::memory_order_release);
+        return grown;
+    }
+};
+
+class TaskPool;
+
+// TaskGroup is a set of tasks spawned on a TaskPool which the spawning
+// thread waits for. Waiting threads run pending tasks rather than block,
+// so groups may be nested to any depth for fork-join parallelism.
+class TaskGroup
+{
+public:
+    explicit TaskGroup(TaskPool& pool) : pool(pool) { }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup()
+    {
+        try {
+            wait();
+        }
+        catch (...) {
+            // Errors are only reported by an explicit wait.
+        }
+    }
+
+    // spawn schedules f to run on the pool.
+    template <typename F>
+    void spawn(F&& f);
+
+    // wait returns once every spawned task has finished, rethrowing the
+    // first exception thrown by a task.
+    void wait();
+
+private:
+    friend class TaskPool;
+
+    TaskPool& pool;
+    std::atomic<std::size_t> pending{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    // finish records that a task of the group ended, with error if it threw.
+    void finish(std::exception_ptr e)
+    {
+        if (e) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = e;
+            }
+        }
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+};
+
+// TaskPool is a fixed set of worker threads which share work by stealing.
+// Each worker owns a WorkStealingDeque: tasks spawned by a worker are
+// pushed onto its own deque and popped LIFO, and an idle worker steals
+// the oldest task of a random victim. Tasks spawned from outside the
+// pool go through a shared queue.
+class TaskPool
+{
+public:
+    explicit TaskPool(std::size_t nthreads = std::thread::hardware_concurrency())
+    {
+        nthreads = nthreads ? nthreads : 1;
+        for (std::size_t i = 0; i < nthreads; ++i) {
+            deques.push_back(std::make_unique<WorkStealingDeque<Task*>>());
+        }
+        for (std::size_t i = 0; i < nthreads; ++i) {
+            threads.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    ~TaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    // run calls f on the pool and waits for it to finish.
+    template <typename F>
+    void run(F&& f)
+    {
+        TaskGroup group(*this);
+        group.spawn(std::forward<F>(f));
+        group.wait();
+    }
+
+    // invoke calls f and g, possibly in parallel, and waits for both.
+    template <typename F, typename G>
+    void invoke(F&& f, G&& g)
+    {
+        TaskGroup group(*this);
+        group.spawn(std::forward<G>(g));
+        f();
+        group.wait();
+    }
+
+    // size returns the number of worker threads.
+    std::size_t size() const
+    {
+        return threads.size();
+    }
+
+private:
+    friend class TaskGroup;
+
+    // Task is a spawned function and the group waiting for it.
+    struct Task
+    {
+        std::function<void()> fn;
+        TaskGroup* group;
+    };
+
+    // Worker identifies the pool and deque owned by the calling thread.
+    struct Worker
+    {
+        TaskPool* pool = nullptr;
+        std::size_t index = 0;
+        std::uint64_t seed = 0;
+    };
+
+    std::vector<std::unique_ptr<WorkStealingDeque<Task*>>> deques;
+    std::vector<std::thread> threads;
+
+    // Tasks submitted by threads outside the pool.
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Task*> injected;
+    bool stopping = false;
+    std::atomic<std::size_t> sleeping{0};
+
+    static Worker& worker()
+    {
+        thread_local Worker w;
+        return w;
+    }
+
+    // submit queues task, waking a sleeping worker if there is one.
+    void submit(Task* task)
+    {
+        auto& w = worker();
+        if (w.pool == this) {
+            deques[w.index]->push(task);
+        }
+        else {
+            std::lock_guard<std::mutex> lock(mutex);
+            injected.push_back(task);
+        }
+        if (sleeping.load(std::memory_order_acquire)) {
+            cv.notify_one();
+        }
+    }
+
+    // find takes a task from the caller's own deque, the shared queue or
+    // another worker's deque, in that order.
+    Task* find()
+    {
+        auto& w = worker();
+        Task* task = nullptr;
+        if (w.pool == this && deques[w.index]->pop(task)) {
+            return task;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!injected.empty()) {
+                task = injected.front();
+                injected.pop_front();
+                return task;
+            }
+        }
+        // Steal starting from a random victim.
+        w.seed = w.seed*6364136223846793005ULL + 1442695040888963407ULL;
+        auto n = deques.size();
+        auto start = std::size_t(w.seed >> 33) % n;
+        for (std::size_t i = 0; i < n; ++i) {
+            auto victim = (start + i) % n;
+            if ((w.pool != this || victim != w.index) && deques[victim]->steal(task)) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    // run_one runs a single task if one can be found.
+    bool run_one()
+    {
+        auto task = find();
+        if (!task) {
+            return false;
+        }
+        std::exception_ptr e;
+        try {
+            task->fn();
+        }
+        catch (...) {
+            e = std::current_exception();
+        }
+        auto group = task->group;
+        delete task;
+        group->finish(e);
+        return true;
+    }
+
+    // work is the loop run by worker thread index.
+    void work(std::size_t index)
+    {
+        auto& w = worker();
+        w.pool = this;
+        w.index = index;
+        w.seed = index + 1;
+
+        for (;;) {
+            if (run_one()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            if (stopping) {
+                break;
+            }
+            if (!injected.empty()) {
+                continue;
+            }
+            // Sleep briefly; a steal may become possible without notice.
+            sleeping.fetch_add(1, std::memory_order_acq_rel);
+            cv.wait_for(lock, std::chrono::milliseconds(1));
+            sleeping.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+};
+
+template <typename F>
+void TaskGroup::spawn(F&& f)
+{
+    // The task is counted only once it exists, and uncounted again if it
+    // cannot be queued, so a failed spawn does not leave wait spinning.
+    std::unique_ptr<TaskPool::Task> task(new TaskPool::Task{std::forward<F>(f), this});
+    pending.fetch_add(1, std::memory_order_relaxed);
+    try {
+        pool.submit(task.get());
+    }
+    catch (...) {
+        pending.fetch_sub(1, std::memory_order_relaxed);
+        throw;
+    }
+    task.release();
+}
+
+inline void TaskGroup::wait()
+{
+    while (pending.load(std::memory_order_acquire)) {
+        if (!pool.run_one()) {
+            std::this_thread::yield();
+        }
+    }
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (error) {
+        auto e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+}